@@ -0,0 +1,96 @@
+-- =============================================================================
+-- File:                    cosim_dmi.vhdl
+--
+-- Entity:                  cosim_dmi
+--
+-- Description:             Co-simulation virtual RISC-V debug module interface
+--                          (DMI) "connector". OpenOCD connects just like it
+--                          does to cosim_jtag, but the JTAG debug transport
+--                          module (DTM) is emulated in C. Only the resulting
+--                          DMI accesses reach the simulation, where they are
+--                          carried out over the DMI bus of the debug module.
+--
+-- Note #1:                 A request is held in dmi_req_valid until the debug
+--                          module acknowledges it with dmi_req_ready. Then the
+--                          entity waits for dmi_rsp_valid, a read returns its
+--                          value in dmi_rsp_data. Only one request is in flight
+--                          at a time.
+--
+-- Note #2:                 Instances of cosim_dmi and cosim_jtag share the same
+--                          range of ID generics, see README.
+--
+-- Author:                  Niklaus Leuenberger <@NikLeberg>
+--
+-- SPDX-License-Identifier: MIT
+--
+-- Version:                 0.1
+--
+-- Changes:                 0.1, 2026-10-14, NikLeberg
+--                              initial version
+-- =============================================================================
+
+LIBRARY ieee;
+USE ieee.std_logic_1164.ALL;
+USE ieee.numeric_std.ALL;
+
+LIBRARY cosim;
+USE cosim.cosim_jtag_pkg.ALL;
+
+ENTITY cosim_dmi IS
+    GENERIC (
+        ID : NATURAL := 0 -- unique id of instance, selects the socket
+    );
+    PORT (
+        clk           : IN STD_ULOGIC; -- system clock
+        dmi_req_valid : OUT STD_ULOGIC := '0';
+        dmi_req_ready : IN STD_ULOGIC;
+        dmi_req_op    : OUT STD_ULOGIC_VECTOR(1 DOWNTO 0); -- "01" read, "10" write
+        dmi_req_addr  : OUT STD_ULOGIC_VECTOR(6 DOWNTO 0);
+        dmi_req_data  : OUT STD_ULOGIC_VECTOR(31 DOWNTO 0);
+        dmi_rsp_valid : IN STD_ULOGIC;
+        dmi_rsp_data  : IN STD_ULOGIC_VECTOR(31 DOWNTO 0);
+        srst          : OUT STD_LOGIC -- system reset, active-high
+    );
+END ENTITY;
+
+ARCHITECTURE sim OF cosim_dmi IS
+BEGIN
+
+    -- Call into C-function while no DMI access is in flight.
+    dmi_tick_proc : PROCESS (clk)
+        VARIABLE v_rsp_valid, v_req_valid, v_srst : STD_ULOGIC := '0';
+        VARIABLE v_rsp_data, v_req_data : INTEGER := 0;
+        VARIABLE v_req_op, v_req_addr : NATURAL := 0;
+        VARIABLE v_skip : NATURAL := 0;
+        VARIABLE v_pending : BOOLEAN := FALSE; -- waiting on response
+    BEGIN
+        IF rising_edge(clk) THEN
+            IF v_pending THEN
+                IF v_req_valid = '1' AND dmi_req_ready = '1' THEN
+                    dmi_req_valid <= '0';
+                    v_req_valid := '0';
+                END IF;
+                IF v_req_valid = '0' AND dmi_rsp_valid = '1' THEN
+                    v_rsp_valid := '1';
+                    v_rsp_data := to_integer(signed(dmi_rsp_data));
+                    v_pending := FALSE;
+                END IF;
+            ELSIF v_skip > 0 THEN
+                v_skip := v_skip - 1;
+            ELSE
+                dmi_tick(ID, v_rsp_valid, v_rsp_data, v_req_valid, v_req_op,
+                v_req_addr, v_req_data, v_srst, v_skip);
+                v_rsp_valid := '0';
+                srst <= v_srst;
+                IF v_req_valid = '1' THEN
+                    dmi_req_valid <= '1';
+                    dmi_req_op <= STD_ULOGIC_VECTOR(to_unsigned(v_req_op, 2));
+                    dmi_req_addr <= STD_ULOGIC_VECTOR(to_unsigned(v_req_addr, 7));
+                    dmi_req_data <= STD_ULOGIC_VECTOR(to_signed(v_req_data, 32));
+                    v_pending := TRUE;
+                END IF;
+            END IF;
+        END IF;
+    END PROCESS dmi_tick_proc;
+
+END ARCHITECTURE;
@@ -3,8 +3,8 @@
  * @author Niklaus Leuenberger <@NikLeberg>
  * @brief Implements interface between VHDL (through VHPIDIRCET or MTI FLI) and
  *        OpenOCD (through remote bitbanging socket).
- * @version 0.5
- * @date 2024-09-22
+ * @version 0.35
+ * @date 2026-10-14
  *
  * SPDX-License-Identifier: MIT
  *
@@ -16,17 +16,84 @@
  *                                 interface and rename to cosim_jtag
  * 0.4      2024-08-20  NikLeberg  print success message on socket creation
  * 0.5      2024-08-22  NikLeberg  implement standard VHPI interface
+ * 0.6      2026-10-14  NikLeberg  receive socket data in chunks into a ring
+ *                                 buffer instead of one read() per tick
+ * 0.7      2026-10-14  NikLeberg  optional non-blocking data socket, handle
+ *                                 remote closing the connection
+ * 0.8      2026-10-14  NikLeberg  buffer replies to read requests and send
+ *                                 them in batches
+ * 0.9      2026-10-14  NikLeberg  extended protocol with packed scans
+ * 0.10     2026-10-14  NikLeberg  optionally return two tck edges per tick
+ * 0.11     2026-10-14  NikLeberg  let VHDL skip clks while JTAG is idle
+ * 0.12     2026-10-14  NikLeberg  report which outputs changed since last tick
+ * 0.13     2026-10-14  NikLeberg  resolve VHPI handles and values only once
+ * 0.14     2026-10-14  NikLeberg  configurable socket, support TCP
+ * 0.15     2026-10-14  NikLeberg  support multiple instances, each with its
+ *                                 own state and socket
+ * 0.16     2026-10-14  NikLeberg  poll sockets of all instances together with
+ *                                 epoll instead of trying every socket
+ * 0.17     2026-10-14  NikLeberg  look for new connections only every few ms
+ * 0.18     2026-10-14  NikLeberg  optional background thread doing all socket
+ *                                 I/O, rings are lock-free SPSC queues
+ * 0.19     2026-10-14  NikLeberg  shared memory transport
+ * 0.20     2026-10-14  NikLeberg  track TAP state, let VHDL play out runs of
+ *                                 plain tck toggles on its own
+ * 0.21     2026-10-14  NikLeberg  optionally let VHDL shift out whole scans
+ * 0.22     2026-10-14  NikLeberg  DMI mode, emulate RISC-V DTM and hand DMI
+ *                                 accesses to VHDL entity cosim_dmi
+ * 0.23     2026-10-14  NikLeberg  optional counters and histograms, dumped on
+ *                                 'Q', at the end or on SIGUSR1
+ * 0.24     2026-10-14  NikLeberg  record sessions to a file and replay them
+ *                                 without a remote, checking all replies
+ * 0.25     2026-10-14  NikLeberg  optionally wait for a remote, ready marker
+ * 0.26     2026-10-14  NikLeberg  optionally sleep while an idle remote is
+ *                                 connected in non-blocking mode
+ * 0.27     2026-10-14  NikLeberg  FLI: keep state across checkpoint/restore
+ * 0.28     2026-10-14  NikLeberg  split tick from the argument passing of the
+ *                                 simulator interfaces, pass VHPI logic values
+ *                                 through unconverted
+ * 0.29     2026-10-14  NikLeberg  tick_packed for entity cosim_jtag_packed
+ * 0.30     2026-10-14  NikLeberg  DPI-C tick for SystemVerilog (Verilator)
+ * 0.31     2026-10-14  NikLeberg  split command decoder from transport I/O
+ * 0.32     2026-10-14  NikLeberg  match runs of clocks and classic bits eight
+ *                                 bytes at once
+ * 0.33     2026-10-14  NikLeberg  live telemetry in shared memory
+ * 0.34     2026-10-14  NikLeberg  per-process endpoints for parallel runs: %p
+ *                                 in paths, ephemeral TCP ports, ready file
+ *                                 for OpenOCD, never steal a live socket
+ * 0.35     2026-10-14  NikLeberg  FLI: register checkpoint callbacks from the
+ *                                 init function of a foreign module, save and
+ *                                 play out unprocessed commands
  *
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <limits.h>
 
 #ifdef USE_VHPI
 #include <vhpi_user.h> // this header is provided by the simulator
@@ -37,6 +104,7 @@
         vhpi_assert(vhpiFailure, __VA_ARGS__); \
         vhpi_control(vhpiStop);                \
     }
+#define FINISH() vhpi_control(vhpiFinish)
 #else
 #define PRINT(...) fprintf(stderr, __VA_ARGS__)
 #define FAIL(...)           \
@@ -44,192 +112,3440 @@
         PRINT(__VA_ARGS__); \
         exit(EXIT_FAILURE); \
     }
+#define FINISH() exit(EXIT_SUCCESS)
 #endif // USE_VHPI
 
-#define SOCKET_NAME "/tmp/cosim_jtag.sock"
-static int listen_socket = -1;
-static int data_socket = -1;
+#ifdef USE_FLI
+#include <mti.h> // this header is provided by the simulator
+#endif // USE_FLI
 
-static int create_socket(void)
+#include "cosim_jtag_shm.h"
+#include "cosim_jtag_telemetry.h"
+
+// Runtime configuration. Read once from environment variables on first tick.
+typedef struct
+{
+    // COSIM_JTAG_SOCKET: Where to listen for OpenOCD. Either the path of a
+    // UNIX socket (optionally prefixed with "unix:"), "tcp:[<host>:]<port>" or
+    // "shm:/<name>" for the shared memory transport of cosim_jtag_shm.h.
+    // Instance N > 0 uses COSIM_JTAG_SOCKET_<N> or otherwise derives its own
+    // endpoint from this one, see instance_endpoint(). Any "%p" is replaced by
+    // the process id and port 0 lets the kernel pick a free one, both so that
+    // parallel simulations don't collide.
+    const char *socket;
+    // COSIM_JTAG_NONBLOCK: If set to 1, the simulation keeps running while
+    // OpenOCD has no commands to send instead of blocking in read().
+    unsigned int nonblock;
+    // COSIM_JTAG_IDLE_POLL: In non-blocking mode, number of clks VHDL may skip
+    // before the next tick after the socket was found to be empty.
+    unsigned int idle_poll;
+    // COSIM_JTAG_IDLE_SLEEP: In non-blocking mode, sleep up to this many ms
+    // (at most 999) per tick while the remote has nothing to send. 0 is off.
+    unsigned int idle_sleep;
+    // COSIM_JTAG_IDLE_SLEEP_AFTER: Number of empty ticks in a row before
+    // starting to sleep.
+    unsigned int idle_sleep_after;
+    // COSIM_JTAG_ACCEPT_POLL: Number of clks VHDL may skip before the next
+    // tick while no remote is connected.
+    unsigned int accept_poll;
+    // COSIM_JTAG_ACCEPT_INTERVAL: While no remote is connected, minimum time in
+    // ms between two checks for new connections.
+    unsigned int accept_interval;
+    // COSIM_JTAG_PAIRED: If set to 1, a single tick may return two edges of
+    // tck. VHDL then plays out the second edge without calling into C.
+    unsigned int paired;
+    // COSIM_JTAG_THREAD: If set to 1, a background thread does all the socket
+    // I/O and tick only exchanges data with it through memory.
+    unsigned int thread;
+    // COSIM_JTAG_SHIFT: If set to 1, scans are handed to VHDL as vectors and
+    // shifted out there, one tick per scan instead of per edge.
+    unsigned int shift;
+    // COSIM_JTAG_DMI_IDCODE: IDCODE of the DTM emulated for cosim_dmi.
+    unsigned int dmi_idcode;
+    // COSIM_JTAG_STATS: Collect counters and histograms, see stats_print().
+    unsigned int stats;
+    // COSIM_JTAG_RECORD: Record all commands and replies to this file.
+    const char *record;
+    // COSIM_JTAG_REPLAY: Replay a recorded file instead of listening for a
+    // remote and end the simulation once done.
+    const char *replay;
+    // COSIM_JTAG_WAIT: Whether to block the simulation until a remote is
+    // connected, see WAIT_* below.
+    unsigned int wait;
+    // COSIM_JTAG_READY: File to create once all instances accept remotes,
+    // OpenOCD Tcl if its name ends in ".tcl", see announce_ready().
+    const char *ready;
+    // COSIM_JTAG_TELEMETRY: Shared memory object to publish live telemetry in,
+    // see cosim_jtag_telemetry.h.
+    const char *telemetry;
+} config_t;
+
+#define WAIT_NEVER 0  // run freely, serve a remote once it connects
+#define WAIT_FIRST 1  // block until the first remote connected
+#define WAIT_ALWAYS 2 // block whenever no remote is connected
+#define WAIT_TIMEOUT 100 // ms, upper bound of a single sleep while waiting
+
+static config_t config = {"/tmp/cosim_jtag.sock", 0, 32, 0, 1000, 1024, 50, 0, 0, 0, 0x00000001, 0, NULL, NULL, WAIT_NEVER, NULL, NULL};
+static int config_loaded = 0;
+
+static unsigned int env_uint(const char *name, unsigned int fallback)
+{
+    const char *value = getenv(name);
+    if (NULL == value || '\0' == value[0])
+    {
+        return fallback;
+    }
+    return (unsigned int)strtoul(value, NULL, 0);
+}
+
+static const char *env_str(const char *name, const char *fallback)
+{
+    const char *value = getenv(name);
+    if (NULL == value || '\0' == value[0])
+    {
+        return fallback;
+    }
+    return value;
+}
+
+// Same as env_str(), but with every "%p" replaced by the process id. E.g.
+// "/tmp/cosim_jtag_%p.sock" gives each simulation on a host its own socket.
+static const char *env_path(const char *name, const char *fallback)
+{
+    const char *value = env_str(name, fallback);
+    if (NULL == value || NULL == strstr(value, "%p"))
+    {
+        return value;
+    }
+    char pid[16];
+    int pid_len = snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    char *path = malloc(strlen(value) / 2 * pid_len + strlen(value) + 1);
+    if (NULL == path)
+    {
+        FAIL("cosim_jtag: failed to allocate %s\n", name);
+    }
+    char *p = path;
+    while ('\0' != *value)
+    {
+        if ('%' == value[0] && 'p' == value[1])
+        {
+            memcpy(p, pid, pid_len);
+            p += pid_len;
+            value += 2;
+        }
+        else
+        {
+            *p++ = *value++;
+        }
+    }
+    *p = '\0';
+    return path;
+}
+
+// snprintf() for names of sockets, files and shared memory. A truncated name
+// silently refers to something other than what was configured, fail instead.
+static void format_name(char *name, size_t size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(name, size, format, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= size)
+    {
+        FAIL("cosim_jtag: name too long, at most %zu characters: %s...\n", size - 1, name);
+    }
+}
+
+static void load_config(void)
+{
+    config.socket = env_path("COSIM_JTAG_SOCKET", config.socket);
+    config.nonblock = env_uint("COSIM_JTAG_NONBLOCK", config.nonblock);
+    config.idle_poll = env_uint("COSIM_JTAG_IDLE_POLL", config.idle_poll);
+    if (config.idle_poll > INT_MAX)
+    {
+        config.idle_poll = INT_MAX; // VHDL takes skips as NATURAL, e.g. "-1"
+    }
+    config.idle_sleep = env_uint("COSIM_JTAG_IDLE_SLEEP", config.idle_sleep);
+    if (config.idle_sleep > 999)
+    {
+        config.idle_sleep = 999; // sleeps take a timespec without seconds
+    }
+    config.idle_sleep_after = env_uint("COSIM_JTAG_IDLE_SLEEP_AFTER", config.idle_sleep_after);
+    config.accept_poll = env_uint("COSIM_JTAG_ACCEPT_POLL", config.accept_poll);
+    if (config.accept_poll > INT_MAX)
+    {
+        config.accept_poll = INT_MAX; // same as idle_poll
+    }
+    config.accept_interval = env_uint("COSIM_JTAG_ACCEPT_INTERVAL", config.accept_interval);
+    config.paired = env_uint("COSIM_JTAG_PAIRED", config.paired);
+    config.thread = env_uint("COSIM_JTAG_THREAD", config.thread);
+    config.shift = env_uint("COSIM_JTAG_SHIFT", config.shift);
+    config.dmi_idcode = env_uint("COSIM_JTAG_DMI_IDCODE", config.dmi_idcode);
+    config.stats = env_uint("COSIM_JTAG_STATS", config.stats);
+    config.record = env_path("COSIM_JTAG_RECORD", config.record);
+    config.replay = env_str("COSIM_JTAG_REPLAY", config.replay);
+    if (NULL != config.replay)
+    {
+        config.thread = 0; // no I/O to offload
+    }
+    config.wait = env_uint("COSIM_JTAG_WAIT", config.wait);
+    config.ready = env_path("COSIM_JTAG_READY", config.ready);
+    if (NULL != config.ready)
+    {
+        unlink(config.ready); // left over from a previous simulation
+    }
+    config.telemetry = env_path("COSIM_JTAG_TELEMETRY", config.telemetry);
+    config_loaded = 1;
+}
+
+// Possible states of an VHDL STD_ULOGIC enumeration.
+enum HDL_LOGIC_STATES
+{
+    HDL_U = 0, // Uninitialized
+    HDL_X = 1, // Forcing Unknown
+    HDL_0 = 2, // Forcing 0
+    HDL_1 = 3, // Forcing 1
+    HDL_Z = 4, // High Impedance
+    HDL_W = 5, // Weak Unknown
+    HDL_L = 6, // Weak 0
+    HDL_H = 7, // Weak 1
+    HDL_D = 8  // Don't care
+};
+#define HDL_TO_INT(hdl) ((hdl) == HDL_1 || (hdl) == HDL_H)
+#define INT_TO_HDL(i) (((i) != 0) ? HDL_1 : HDL_0)
+
+typedef struct
+{
+    // tdo is received from VHDL on every tick, not required to keep state
+    char tck;
+    char tms;
+    char tdi;
+    char trst;
+    char srst;
+} state_t;
+
+// States of the IEEE 1149.1 TAP controller.
+enum TAP_STATES
+{
+    TAP_RESET = 0, // Test-Logic-Reset
+    TAP_IDLE,      // Run-Test/Idle
+    TAP_DRSELECT,
+    TAP_DRCAPTURE,
+    TAP_DRSHIFT,
+    TAP_DREXIT1,
+    TAP_DRPAUSE,
+    TAP_DREXIT2,
+    TAP_DRUPDATE,
+    TAP_IRSELECT,
+    TAP_IRCAPTURE,
+    TAP_IRSHIFT,
+    TAP_IREXIT1,
+    TAP_IRPAUSE,
+    TAP_IREXIT2,
+    TAP_IRUPDATE
+};
+
+// Next TAP state on a rising edge of tck, indexed by state and tms.
+static const unsigned char tap_next[16][2] = {
+    {TAP_IDLE, TAP_RESET},        // TAP_RESET
+    {TAP_IDLE, TAP_DRSELECT},     // TAP_IDLE
+    {TAP_DRCAPTURE, TAP_IRSELECT}, // TAP_DRSELECT
+    {TAP_DRSHIFT, TAP_DREXIT1},   // TAP_DRCAPTURE
+    {TAP_DRSHIFT, TAP_DREXIT1},   // TAP_DRSHIFT
+    {TAP_DRPAUSE, TAP_DRUPDATE},  // TAP_DREXIT1
+    {TAP_DRPAUSE, TAP_DREXIT2},   // TAP_DRPAUSE
+    {TAP_DRSHIFT, TAP_DRUPDATE},  // TAP_DREXIT2
+    {TAP_IDLE, TAP_DRSELECT},     // TAP_DRUPDATE
+    {TAP_IRCAPTURE, TAP_RESET},   // TAP_IRSELECT
+    {TAP_IRSHIFT, TAP_IREXIT1},   // TAP_IRCAPTURE
+    {TAP_IRSHIFT, TAP_IREXIT1},   // TAP_IRSHIFT
+    {TAP_IRPAUSE, TAP_IRUPDATE},  // TAP_IREXIT1
+    {TAP_IRPAUSE, TAP_IREXIT2},   // TAP_IRPAUSE
+    {TAP_IRSHIFT, TAP_IRUPDATE},  // TAP_IREXIT2
+    {TAP_IDLE, TAP_DRSELECT}      // TAP_IRUPDATE
+};
+
+// Size of the socket receive and transmit buffers in bytes, must be a power of
+// two. Replies get sent latest when the transmit buffer is half full.
+#define RING_SIZE 4096
+#define RING_MASK (RING_SIZE - 1)
+#define TX_FLUSH_THRESHOLD (RING_SIZE / 2)
+
+// Longest packed scan of the extended protocol. A complete request has to fit
+// into the receive ring, its reply into the transmit ring.
+#define SCAN_MAX_BITS 8192
+#define SCAN_MAX_BYTES (SCAN_MAX_BITS / 8)
+
+// Simple ring buffer. Head and tail indices are free running and only wrapped
+// on access, as such head - tail is always the number of buffered bytes. With
+// the I/O thread, each ring has exactly one producer (writes head) and one
+// consumer (writes tail). Indices are published with release and read with
+// acquire semantics, which is free on x86.
+typedef struct
+{
+    char data[RING_SIZE];
+    unsigned int head; // next index to write to
+    unsigned int tail; // next index to read from
+} ring_t;
+
+// Scan that is currently being played out, see 'X' command below.
+typedef struct
+{
+    unsigned int active;  // scan in progress
+    unsigned int capture; // reply with captured tdo when done
+    unsigned int len;     // length of scan in bits
+    unsigned int pos;     // current bit
+    unsigned int phase;   // 0: drive tck low, 1: sample tdo and drive tck high
+    unsigned char tms[SCAN_MAX_BYTES];
+    unsigned char tdi[SCAN_MAX_BYTES];
+    unsigned char tdo[SCAN_MAX_BYTES];
+} scan_t;
+
+// Scan vectors exchanged with VHDL, must match SCAN_VECTOR_BITS of the VHDL
+// package. Longer scans are handed over in multiple chunks.
+#define VSCAN_BITS 256
+// Shorter runs of classic bits are not worth the vectors.
+#define VSCAN_MIN_BITS 2
+
+// Bits currently being shifted out by VHDL.
+typedef struct
+{
+    unsigned int len;               // number of bits, 0 if none
+    unsigned int packed;            // chunk of the active packed scan
+    unsigned char read[VSCAN_BITS]; // classic bits: reply tdo to read request
+} vscan_t;
+
+// RISC-V debug transport module (DTM) as emulated for cosim_dmi, see chapter
+// 6.1 of "RISC-V External Debug Support" version 0.13. The DMI register is
+// 41 bits: op (1:0), data (33:2) and address (40:34).
+#define DTM_IR_LEN 5
+#define DTM_IR_IDCODE 0x01
+#define DTM_IR_DTMCS 0x10
+#define DTM_IR_DMI 0x11
+#define DMI_ABITS 7
+#define DMI_LEN (DMI_ABITS + 34)
+#define DMI_OP_READ 1
+#define DMI_OP_WRITE 2
+#define DMI_STATUS_FAILED 2
+
+typedef struct
+{
+    unsigned int ir;       // current instruction
+    unsigned int ir_shift; // instruction register being shifted
+    uint64_t dr_shift;     // data register being shifted
+    unsigned int dr_len;   // length of selected data register
+    // Last DMI access, captured by the next DMI scan.
+    unsigned int addr;
+    uint32_t data;
+    unsigned int status;
+    // DMI access to be handed to VHDL (1) or in progress there (2).
+    unsigned int request;
+    unsigned int req_op;
+    unsigned int req_addr;
+    uint32_t req_data;
+} dtm_t;
+
+// Instrumentation, only collected with COSIM_JTAG_STATS=1. Commands are
+// counted in bytes by type as they get consumed. Syscalls of the I/O thread
+// are counted there, hence the atomic add.
+enum STAT_COMMANDS
+{
+    STAT_WRITE, // '0' to '7'
+    STAT_READ,  // 'R'
+    STAT_RESET, // 'r' to 'u'
+    STAT_SCAN,  // 'X' and 'x' including payload
+    STAT_OTHER, // 'B', 'b', 'Q' and unknown
+    STAT_COMMAND_TYPES
+};
+#define STAT_TICK_BUCKETS 24 // log2 of ns per tick, last one is open ended
+
+typedef struct
+{
+    uint64_t ticks;
+    uint64_t busy_ticks;  // ticks that consumed commands
+    uint64_t commands;    // bytes consumed, all types
+    uint64_t command_bytes[STAT_COMMAND_TYPES];
+    uint64_t scan_bits;   // bits shifted by packed scans
+    uint64_t rx_syscalls; // read() on the data socket
+    uint64_t rx_bytes;
+    uint64_t tx_syscalls; // send() on the data socket
+    uint64_t tx_bytes;
+    uint64_t tick_ns; // time spent in tick
+    uint64_t tick_hist[STAT_TICK_BUCKETS];
+    // Set by stats_begin() for stats_end().
+    uint64_t tick_start;
+    uint64_t tick_commands;
+} stats_t;
+
+#define STAT_ADD(inst, field, n)                                             \
+    do                                                                       \
+    {                                                                        \
+        if (config.stats)                                                    \
+        {                                                                    \
+            __atomic_fetch_add(&(inst)->stats.field, (n), __ATOMIC_RELAXED); \
+        }                                                                    \
+    } while (0)
+
+// Replay of a recorded file, see record_event() for the format. Commands are
+// fed from the rx cursor, replies are checked against the tx cursor.
+typedef struct
+{
+    const unsigned char *data; // whole file, mapped
+    size_t size;
+    size_t rx_pos;               // next record to feed
+    size_t rx_done;              // bytes of it already fed
+    unsigned long long rx_tick;  // tick of the last fed record
+    size_t tx_pos;               // next reply byte to expect
+    size_t tx_left;              // remaining bytes of its record
+    unsigned long long tx_bytes; // replies checked so far
+    unsigned int eof;            // all records fed
+    unsigned int done;
+} replay_t;
+
+// Everything belonging to one cosim_jtag entity in the design. Each instance
+// has its own socket and thereby its own OpenOCD connection.
+typedef struct
+{
+    int id; // ID generic of the VHDL entity
+    int listen_socket;
+    int data_socket;
+    int socket_is_tcp;
+    char socket_name[PATH_MAX]; // for messages, path or host:port
+
+    // Number of clks VHDL may skip before calling the next tick.
+    unsigned int skip_hint;
+    // A read request that is answered with tdo of the next tick (paired mode).
+    unsigned int pending_read;
+    // Readiness of the listen and data socket as last reported by epoll. Set
+    // until accept() or read() would block, see socket_ready(). Only touched
+    // by the I/O thread if there is one.
+    unsigned int acceptable;
+    unsigned int readable;
+
+    // With I/O thread: Connection state as handed between the threads, see
+    // LINK_* below. linked is the view of the simulator thread.
+    unsigned int link;
+    unsigned int linked;
+    // Simulator thread sleeps on rx_ring.head, waiting for commands.
+    unsigned int rx_waiting;
+
+    // Shared memory transport, replaces the sockets if set.
+    cosim_jtag_shm_t *shm;
+    // Replay, replaces the sockets if set.
+    replay_t *replay;
+    // Recording of the session if set.
+    FILE *record;
+    unsigned int record_rx;         // commands up to here are recorded
+    unsigned int record_tx;         // replies up to here are recorded
+    unsigned long long record_tick; // tick of the last record
+    // Calls into C so far, the time base of recordings.
+    unsigned long long tick;
+    // A remote was connected at some point.
+    unsigned int had_remote;
+    // Refills in a row that found nothing to receive.
+    unsigned int idle_refills;
+    // Counters for the telemetry, see publish_telemetry(). Kept regardless, an
+    // increment is cheaper than checking whether anyone is interested.
+    uint64_t cycles; // rising edges of tck
+    uint64_t dry;    // receive ring ran dry while decoding
+    uint64_t telemetry_ns, telemetry_ticks, telemetry_cycles; // last update
+    // Requests of the command decoder to the I/O stage, see exchange_socket().
+    unsigned int rx_need; // receive ring ran dry, bytes needed to go on
+    unsigned int quit;    // remote sent 'Q'
+    // Commands of the remote a restored checkpoint was taken with are played
+    // out to the end before any new remote is served, see restore_fli().
+    unsigned int restored;
+
+    // Commands received from OpenOCD but not yet processed.
+    ring_t rx_ring;
+    // Replies to read requests not yet sent to OpenOCD.
+    ring_t tx_ring;
+    scan_t scan;
+    vscan_t vscan;
+    dtm_t dtm; // cosim_dmi only
+    stats_t stats;
+
+    // Current/last state of tck, tms, tdi, trst and srst.
+    state_t state;
+    // State as it was last driven by VHDL, initially different to everything.
+    state_t driven;
+    // TAP state of the driven TAP, follows every rising edge of tck.
+    unsigned int tap;
+    char tap_tck; // tck of the last tracked edge
+} instance_t;
+
+#define MAX_INSTANCES 16
+static instance_t *instances[MAX_INSTANCES] = {NULL};
+static unsigned int instance_count = 0;
+
+_Static_assert(COSIM_JTAG_TELEMETRY_SLOTS == MAX_INSTANCES, "telemetry needs a slot per instance");
+
+// All listen and data sockets of all instances are watched by one epoll set.
+// The event data encodes the instance id and which of its sockets it is.
+#define EVENT_DATA_SOCKET 1
+#define EVENT_ID_SHIFT 1
+#define EVENT_WAKE 0xffffffff // eventfd of the I/O thread
+#define MAX_EVENTS (2 * MAX_INSTANCES + 1)
+static int epoll_fd = -1;
+// Ticks of any instance since epoll was last asked.
+static unsigned int ticks_since_poll = 0;
+// Time in ms when epoll was last asked for new connections.
+static unsigned long long accept_polled = 0;
+
+static unsigned int ring_count(const ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static void ring_reset(ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static char ring_peek(const ring_t *ring, unsigned int index)
+{
+    return ring->data[(ring->tail + index) & RING_MASK];
+}
+
+// Consumer is done with count bytes.
+static void ring_drop(ring_t *ring, unsigned int count)
+{
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+// Producer has written count bytes.
+static void ring_commit(ring_t *ring, unsigned int count)
+{
+    __atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+}
+
+static char ring_pop(ring_t *ring)
+{
+    char c = ring->data[ring->tail & RING_MASK];
+    ring_drop(ring, 1);
+    return c;
+}
+
+static void ring_push(ring_t *ring, char c)
+{
+    ring->data[ring->head & RING_MASK] = c;
+    ring_commit(ring, 1);
+}
+
+// len bytes of the ring from index start on, in at most two pieces as the ring
+// may wrap. Returns the number of pieces.
+static int ring_iov(ring_t *ring, unsigned int start, unsigned int len, struct iovec iov[2])
+{
+    unsigned int offset = start & RING_MASK;
+    unsigned int first = RING_SIZE - offset;
+    iov[0].iov_base = &ring->data[offset];
+    iov[0].iov_len = (len < first) ? len : first;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = len - iov[0].iov_len;
+    return iov[1].iov_len ? 2 : 1;
+}
+
+// Receive into all free space of the ring with a single syscall, even if it
+// wraps. Only reads, the caller commits what it got.
+static ssize_t ring_receive(int fd, ring_t *ring)
+{
+    struct iovec iov[2];
+    int count = ring_iov(ring, ring->head, RING_SIZE - ring_count(ring), iov);
+    return readv(fd, iov, count);
+}
+
+// Counterpart for sending, the caller drops what was sent.
+static ssize_t ring_send(int fd, ring_t *ring)
+{
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ring_iov(ring, ring->tail, ring_count(ring), iov);
+    // Use send*() over write(), a closed remote must not raise SIGPIPE.
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+// Same byte in all eight bytes of a word, for ring_match().
+#define BYTES(b) ((uint64_t)(b) * 0x0101010101010101ull)
+
+// Number of leading bytes of the ring, at most max, that equal pattern in all
+// bits set in mask. Byte i is compared against byte i % 8 of pattern and mask.
+// Eight bytes are checked at once, the first mismatch then is the lowest byte
+// with any bit left after masking.
+static unsigned int ring_match(const ring_t *ring, unsigned int max, uint64_t pattern, uint64_t mask)
+{
+    unsigned int count = ring_count(ring);
+    count = (count < max) ? count : max;
+    unsigned int n = 0;
+    while (n < count)
+    {
+        // Contiguous part up to where the ring wraps.
+        const char *data = &ring->data[(ring->tail + n) & RING_MASK];
+        unsigned int len = RING_SIZE - ((ring->tail + n) & RING_MASK);
+        len = (len < count - n) ? len : count - n;
+        unsigned int i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        unsigned int rot = 8 * (n & 7);
+        uint64_t p = rot ? (pattern >> rot | pattern << (64 - rot)) : pattern;
+        uint64_t m = rot ? (mask >> rot | mask << (64 - rot)) : mask;
+        for (; i + 8 <= len; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, &data[i], sizeof(word));
+            word = (word ^ p) & m;
+            if (0 != word)
+            {
+                uint64_t high = (((word & BYTES(0x7f)) + BYTES(0x7f)) | word) & BYTES(0x80);
+                return n + i + __builtin_ctzll(high) / 8;
+            }
+        }
+#endif
+        for (; i < len; ++i)
+        {
+            unsigned int shift = 8 * ((n + i) & 7);
+            if (0 != ((data[i] ^ (pattern >> shift)) & (mask >> shift) & 0xff))
+            {
+                return n + i;
+            }
+        }
+        n += len;
+    }
+    return n;
+}
+
+// Sockets are watched edge triggered. Readiness flags stay set until the
+// socket would block, so no event is lost.
+static int watch_socket(instance_t *inst, int fd, unsigned int kind)
+{
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.u32 = (inst->id << EVENT_ID_SHIFT) | kind;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Returns 1 if the eventfd of the I/O thread was among the events.
+static int mark_ready(const struct epoll_event *events, int count)
+{
+    int woken = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (EVENT_WAKE == events[i].data.u32)
+        {
+            woken = 1;
+            continue;
+        }
+        instance_t *inst = instances[events[i].data.u32 >> EVENT_ID_SHIFT];
+        if (events[i].data.u32 & EVENT_DATA_SOCKET)
+        {
+            inst->readable = 1; // also on hangup, read() then reports EOF
+        }
+        else
+        {
+            inst->acceptable = 1;
+        }
+    }
+    return woken;
+}
+
+// Collect readiness of all sockets at once, waiting at most timeout ms.
+static void poll_sockets(int timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+    mark_ready(events, count);
+    ticks_since_poll = 0;
+}
+
+// Check the last known readiness of a socket. If it was not ready, epoll is
+// asked again but at most once per round of ticks over all instances. This
+// keeps the number of syscalls per clk flat, no matter how many instances
+// there are and how many of them are idle.
+static int socket_ready(unsigned int *ready)
+{
+    if (!*ready && ticks_since_poll >= instance_count)
+    {
+        poll_sockets(0);
+    }
+    return *ready;
+}
+
+static unsigned long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // served from vDSO, no syscall
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned long long monotonic_ms(void)
+{
+    return monotonic_ns() / 1000000;
+}
+
+// Recording of a session. The file starts with RECORD_MAGIC and a version
+// byte, followed by records of: type, tick delta to the previous record and
+// length of the payload as unsigned LEB128, then the payload. Types are:
+//  - RECORD_RX:    commands, as they were received in one chunk
+//  - RECORD_TX:    replies, as they were flushed
+//  - RECORD_RESET: remote went away, no payload
+#define RECORD_MAGIC "CJTR"
+#define RECORD_VERSION 1
+#define RECORD_RX 1
+#define RECORD_TX 2
+#define RECORD_RESET 3
+
+static void record_varint(FILE *file, unsigned long long value)
+{
+    do
+    {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), file);
+    } while (value);
+}
+
+// Write a record with count bytes of ring from index on as payload.
+static void record_event(instance_t *inst, int type, const ring_t *ring, unsigned int index, unsigned int count)
+{
+    fputc(type, inst->record);
+    record_varint(inst->record, inst->tick - inst->record_tick);
+    record_varint(inst->record, count);
+    inst->record_tick = inst->tick;
+    while (count)
+    {
+        unsigned int offset = index & RING_MASK;
+        unsigned int len = RING_SIZE - offset;
+        if (len > count)
+        {
+            len = count;
+        }
+        fwrite(&ring->data[offset], 1, len, inst->record);
+        index += len;
+        count -= len;
+    }
+}
+
+static void open_record(instance_t *inst, const char *path)
+{
+    inst->record = fopen(path, "wb");
+    if (NULL == inst->record)
+    {
+        FAIL("cosim_jtag: failed to open %s for recording: %s (%d)\n", path, strerror(errno), errno);
+    }
+    fputs(RECORD_MAGIC, inst->record);
+    fputc(RECORD_VERSION, inst->record);
+    PRINT("cosim_jtag: recording to: %s\n", path);
+}
+
+// Forget everything of the last remote.
+static void reset_connection(instance_t *inst)
+{
+    if (NULL != inst->record)
+    {
+        ring_t *tx = &inst->tx_ring;
+        if (tx->head != inst->record_tx)
+        {
+            record_event(inst, RECORD_TX, tx, inst->record_tx, tx->head - inst->record_tx);
+        }
+        record_event(inst, RECORD_RESET, tx, 0, 0);
+        fflush(inst->record);
+        inst->record_rx = 0;
+        inst->record_tx = 0;
+    }
+    ring_reset(&inst->rx_ring); // discard anything not yet processed
+    ring_reset(&inst->tx_ring); // and anything not yet sent
+    inst->scan.active = 0;
+    inst->vscan.len = 0; // VHDL still shifts it out, but nobody is interested
+    inst->pending_read = 0;
+}
+
+// Background I/O thread. It accepts connections, sends the transmit rings and
+// fills the receive rings of all instances. The simulator thread only ever
+// touches the rings and the link state, it never does a syscall unless it
+// has to wake the I/O thread or wait for commands. All messages and failures
+// are printed from the simulator thread, simulators are not thread safe. The
+// exception is a failure of the I/O thread itself, the simulator thread would
+// wait forever for it otherwise.
+#define LINK_NONE 0 // no remote, I/O thread may accept a new one
+#define LINK_UP 1   // remote connected, I/O thread moves data
+#define LINK_DOWN 2 // remote gone, simulator thread has to clean up
+#define IO_IDLE_TIMEOUT 10 // ms, bounds the cost of any missed wakeup
+#define IO_STALLED 1       // instance needs service again shortly
+
+static int wake_fd = -1;
+static unsigned int io_sleeping = 0;
+
+static void futex_wait(unsigned int *addr, unsigned int value, long timeout_ns)
+{
+    struct timespec ts = {0, timeout_ns};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, &ts, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Simulator thread: Make sure the I/O thread sees newly queued replies.
+static void wake_io(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // order ring update before check
+    if (__atomic_load_n(&io_sleeping, __ATOMIC_RELAXED))
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(wake_fd, &one, sizeof(one));
+        (void)ret; // eventfd may only fail on overflow, it is woken anyway
+    }
+}
+
+// I/O thread: Connection is gone, let the simulator thread clean up.
+static void io_drop(instance_t *inst)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, inst->data_socket, NULL);
+    close(inst->data_socket);
+    inst->data_socket = -1;
+    inst->readable = 0;
+    __atomic_store_n(&inst->link, LINK_DOWN, __ATOMIC_RELEASE);
+    futex_wake(&inst->rx_ring.head);
+}
+
+static void io_accept(instance_t *inst)
+{
+    int fd = accept(inst->listen_socket, NULL, NULL);
+    if (fd == -1)
+    {
+        inst->acceptable = 0;
+        return;
+    }
+    // The I/O thread serves all instances, it must never block on one.
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (inst->socket_is_tcp)
+    {
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    inst->data_socket = fd;
+    if (-1 == watch_socket(inst, fd, EVENT_DATA_SOCKET))
+    {
+        close(fd);
+        inst->data_socket = -1;
+        return;
+    }
+    inst->readable = 1;
+    __atomic_store_n(&inst->link, LINK_UP, __ATOMIC_RELEASE);
+    futex_wake(&inst->link); // simulator thread may wait for a remote
+}
+
+// I/O thread: Move data of one instance. Returns IO_STALLED if the socket or
+// ring was full and the instance should be serviced again soon.
+static int io_service(instance_t *inst)
+{
+    unsigned int link = __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE);
+    if (LINK_NONE == link && inst->acceptable)
+    {
+        io_accept(inst);
+        link = __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE);
+    }
+    if (LINK_UP != link)
+    {
+        return 0;
+    }
+
+    ring_t *tx = &inst->tx_ring;
+    while (ring_count(tx))
+    {
+        int ret = ring_send(inst->data_socket, tx);
+        STAT_ADD(inst, tx_syscalls, 1);
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return IO_STALLED;
+            }
+            io_drop(inst);
+            return 0;
+        }
+        ring_drop(tx, ret);
+        STAT_ADD(inst, tx_bytes, ret);
+    }
+
+    ring_t *rx = &inst->rx_ring;
+    while (inst->readable)
+    {
+        if (RING_SIZE == ring_count(rx))
+        {
+            return IO_STALLED; // simulator is behind, retry once it caught up
+        }
+        int ret = ring_receive(inst->data_socket, rx);
+        STAT_ADD(inst, rx_syscalls, 1);
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            inst->readable = 0;
+            break;
+        }
+        if (ret <= 0)
+        {
+            io_drop(inst);
+            return 0;
+        }
+        ring_commit(rx, ret);
+        STAT_ADD(inst, rx_bytes, ret);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST); // order commit before check
+        if (__atomic_load_n(&inst->rx_waiting, __ATOMIC_RELAXED))
+        {
+            futex_wake(&rx->head);
+        }
+    }
+    return 0;
+}
+
+static void *io_thread(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[MAX_EVENTS];
+    for (;;)
+    {
+        int stalled = 0;
+        for (int id = 0; id < MAX_INSTANCES; ++id)
+        {
+            instance_t *inst = __atomic_load_n(&instances[id], __ATOMIC_ACQUIRE);
+            if (NULL != inst)
+            {
+                stalled |= io_service(inst);
+            }
+        }
+
+        // Announce going to sleep, then look again for replies that got queued
+        // in the meantime. Either they are seen here or the simulator thread
+        // sees io_sleeping and wakes us up.
+        __atomic_store_n(&io_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int timeout = stalled ? 1 : IO_IDLE_TIMEOUT;
+        for (int id = 0; id < MAX_INSTANCES; ++id)
+        {
+            instance_t *inst = __atomic_load_n(&instances[id], __ATOMIC_ACQUIRE);
+            if (NULL != inst && LINK_UP == __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE) &&
+                ring_count(&inst->tx_ring))
+            {
+                timeout = 0;
+            }
+        }
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        __atomic_store_n(&io_sleeping, 0, __ATOMIC_RELAXED);
+
+        // Reset the eventfd only if it fired, it is level triggered.
+        uint64_t wakes;
+        if (mark_ready(events, count) && -1 == read(wake_fd, &wakes, sizeof(wakes)) && errno != EAGAIN)
+        {
+            FAIL("cosim_jtag: I/O thread failed to read eventfd: %s (%d)\n", strerror(errno), errno);
+        }
+    }
+    return NULL;
+}
+
+static void start_io_thread(void)
+{
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1)
+    {
+        FAIL("cosim_jtag: failed to create eventfd: %s (%d)\n", strerror(errno), errno);
+    }
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.u32 = EVENT_WAKE;
+    if (-1 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event))
+    {
+        FAIL("cosim_jtag: failed to watch eventfd with epoll: %s (%d)\n", strerror(errno), errno);
+    }
+
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, io_thread, NULL);
+    if (0 != ret)
+    {
+        FAIL("cosim_jtag: failed to start I/O thread: %s (%d)\n", strerror(ret), ret);
+    }
+    pthread_detach(thread);
+}
+
+// Simulator thread: Follow connection changes made by the I/O thread.
+static void sync_link(instance_t *inst)
+{
+    unsigned int link = __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE);
+    if (LINK_UP == link && !inst->linked)
+    {
+        inst->linked = 1;
+        PRINT("cosim_jtag: remote connected to %s\n", inst->socket_name);
+    }
+    else if (LINK_DOWN == link)
+    {
+        if (inst->linked)
+        {
+            PRINT("cosim_jtag: remote disconnected from %s\n", inst->socket_name);
+        }
+        inst->linked = 0;
+        reset_connection(inst);
+        __atomic_store_n(&inst->link, LINK_NONE, __ATOMIC_RELEASE);
+        wake_io(); // may accept the next remote right away
+    }
+}
+
+// Simulator thread: Hand replies over to the I/O thread. Only waits if the
+// transmit ring is getting full.
+static void flush_thread(instance_t *inst)
+{
+    wake_io();
+    while (ring_count(&inst->tx_ring) >= TX_FLUSH_THRESHOLD &&
+           LINK_UP == __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+// Simulator thread: Sleep until the I/O thread received more commands, but at
+// most timeout_ns.
+static void wait_thread(instance_t *inst, long timeout_ns)
+{
+    ring_t *rx = &inst->rx_ring;
+    unsigned int head = __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&inst->rx_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // order flag before check
+    if (head == __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE))
+    {
+        futex_wait(&rx->head, head, timeout_ns);
+    }
+    __atomic_store_n(&inst->rx_waiting, 0, __ATOMIC_RELAXED);
+}
+
+// Simulator thread: Counterpart of refill_socket(). Waits for the I/O thread
+// to receive more commands, unless non-blocking.
+static int refill_thread(instance_t *inst)
+{
+    ring_t *rx = &inst->rx_ring;
+    unsigned int count = ring_count(rx);
+    if (ring_count(&inst->tx_ring))
+    {
+        wake_io(); // OpenOCD may wait on these replies
+    }
+    while (ring_count(rx) == count)
+    {
+        if (LINK_UP != __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE))
+        {
+            return 0;
+        }
+        if (config.nonblock)
+        {
+            inst->skip_hint = config.idle_poll;
+            return 0;
+        }
+        wait_thread(inst, IO_IDLE_TIMEOUT * 1000000L);
+    }
+    return ring_count(rx) - count;
+}
+
+// Whether the shared memory object name belongs to a simulation that is still
+// running. Its creator stores magic at the start and its process id at offset
+// pid_offset. Objects without, e.g. of an older version, are left overs. Only
+// processes in the same pid namespace can be seen.
+static int shm_owner_alive(const char *name, uint32_t magic, size_t pid_offset)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    size_t size = pid_offset + sizeof(uint32_t);
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (0 == fstat(fd, &st) && (size_t)st.st_size >= size)
+    {
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return 0;
+    }
+    int alive = 0;
+    if (magic == __atomic_load_n((uint32_t *)map, __ATOMIC_ACQUIRE))
+    {
+        uint32_t pid;
+        memcpy(&pid, (const char *)map + pid_offset, sizeof(pid));
+        alive = 0 != pid && (0 == kill((pid_t)pid, 0) || EPERM == errno);
+    }
+    munmap(map, size);
+    return alive;
+}
+
+// Shared memory transport, see cosim_jtag_shm.h for the protocol. It is served
+// directly from the simulator thread, there are no syscalls to offload. Data
+// is copied between the shared rings and the rings of the instance in chunks,
+// just as with a socket.
+static void create_shm(instance_t *inst, const char *name)
+{
+    // Like a UNIX socket, an object left behind by an earlier simulation is
+    // replaced but one still in use is never taken over.
+    if (shm_owner_alive(name, COSIM_JTAG_SHM_MAGIC, offsetof(cosim_jtag_shm_t, pid)))
+    {
+        FAIL("cosim_jtag: create_shm found %s in use by another simulation, give each its own "
+             "with e.g. COSIM_JTAG_SOCKET=shm:/cosim_jtag_%%p\n",
+             name);
+    }
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1)
+    {
+        FAIL("cosim_jtag: create_shm failed to open shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+    if (-1 == ftruncate(fd, sizeof(cosim_jtag_shm_t)))
+    {
+        FAIL("cosim_jtag: create_shm failed to resize shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+    void *map = mmap(NULL, sizeof(cosim_jtag_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        FAIL("cosim_jtag: create_shm failed to map shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+
+    // Freshly truncated memory is zeroed, i.e. empty rings and no remote.
+    inst->shm = (cosim_jtag_shm_t *)map;
+    inst->shm->version = COSIM_JTAG_SHM_VERSION;
+    inst->shm->pid = (uint32_t)getpid();
+    __atomic_store_n(&inst->shm->magic, COSIM_JTAG_SHM_MAGIC, __ATOMIC_RELEASE);
+    format_name(inst->socket_name, sizeof(inst->socket_name), "%s", name);
+}
+
+// Follow attaching and detaching of the remote.
+static void sync_shm(instance_t *inst)
+{
+    cosim_jtag_shm_t *shm = inst->shm;
+    unsigned int state = __atomic_load_n(&shm->state, __ATOMIC_ACQUIRE);
+    if (COSIM_JTAG_SHM_ATTACHED == state && !inst->linked)
+    {
+        inst->linked = 1;
+        PRINT("cosim_jtag: remote connected to %s\n", inst->socket_name);
+    }
+    else if (COSIM_JTAG_SHM_DETACHED == state)
+    {
+        if (inst->linked)
+        {
+            PRINT("cosim_jtag: remote disconnected from %s\n", inst->socket_name);
+        }
+        inst->linked = 0;
+        reset_connection(inst);
+        shm->to_sim.head = shm->to_sim.tail = 0;
+        shm->to_remote.head = shm->to_remote.tail = 0;
+        __atomic_store_n(&shm->state, COSIM_JTAG_SHM_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+static int shm_attached(instance_t *inst)
+{
+    return COSIM_JTAG_SHM_ATTACHED == __atomic_load_n(&inst->shm->state, __ATOMIC_ACQUIRE);
+}
+
+// Counterpart of flush_socket(). Only waits if the remote does not keep up.
+static void flush_shm(instance_t *inst)
+{
+    ring_t *ring = &inst->tx_ring;
+    while (ring_count(ring))
+    {
+        unsigned int offset = ring->tail & RING_MASK;
+        unsigned int len = ring_count(ring);
+        if (len > RING_SIZE - offset)
+        {
+            len = RING_SIZE - offset;
+        }
+        unsigned int ret = cosim_jtag_shm_write(&inst->shm->to_remote, &ring->data[offset], len);
+        ring_drop(ring, ret);
+        if (0 == ret)
+        {
+            if (!shm_attached(inst))
+            {
+                return;
+            }
+            sched_yield();
+        }
+    }
+}
+
+// Counterpart of refill_socket().
+static int refill_shm(instance_t *inst)
+{
+    flush_shm(inst); // remote may wait on our replies
+
+    cosim_jtag_shm_ring_t *to_sim = &inst->shm->to_sim;
+    ring_t *ring = &inst->rx_ring;
+    unsigned int offset = ring->head & RING_MASK;
+    unsigned int space = RING_SIZE - ring_count(ring);
+    if (space > RING_SIZE - offset)
+    {
+        space = RING_SIZE - offset;
+    }
+
+    for (;;)
+    {
+        unsigned int head = __atomic_load_n(&to_sim->head, __ATOMIC_ACQUIRE);
+        unsigned int ret = cosim_jtag_shm_read(to_sim, &ring->data[offset], space);
+        if (ret)
+        {
+            ring_commit(ring, ret);
+            return ret;
+        }
+        if (!shm_attached(inst))
+        {
+            return 0;
+        }
+        if (config.nonblock)
+        {
+            inst->skip_hint = config.idle_poll;
+            return 0;
+        }
+        cosim_jtag_shm_wait(to_sim, head, IO_IDLE_TIMEOUT * 1000000L);
+    }
+}
+
+// Replay: Parse the record header at pos. Returns its type, or 0 at the end.
+static int replay_record(const replay_t *rp, size_t *pos, unsigned long long *delta, size_t *len)
+{
+    if (*pos >= rp->size)
+    {
+        return 0;
+    }
+    int type = rp->data[(*pos)++];
+    unsigned long long values[2] = {0, 0};
+    for (int i = 0; i < 2; ++i)
+    {
+        for (int shift = 0; *pos < rp->size; shift += 7)
+        {
+            unsigned char byte = rp->data[(*pos)++];
+            values[i] |= (unsigned long long)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                break;
+            }
+        }
+    }
+    *delta = values[0];
+    *len = values[1];
+    if (*pos + *len > rp->size)
+    {
+        FAIL("cosim_jtag: replay file is truncated\n");
+    }
+    return type;
+}
+
+static unsigned int replays_active = 0;
+
+static void create_replay(instance_t *inst, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        FAIL("cosim_jtag: failed to open %s for replay: %s (%d)\n", path, strerror(errno), errno);
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    void *map = (size > 0) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    size_t header = strlen(RECORD_MAGIC) + 1;
+    if (MAP_FAILED == map || (size_t)size < header || 0 != memcmp(map, RECORD_MAGIC, header - 1) ||
+        RECORD_VERSION != ((const unsigned char *)map)[header - 1])
+    {
+        FAIL("cosim_jtag: %s is not a recording of version %d\n", path, RECORD_VERSION);
+    }
+
+    replay_t *rp = calloc(1, sizeof(replay_t));
+    if (NULL == rp)
+    {
+        FAIL("cosim_jtag: failed to allocate replay of instance %d\n", inst->id);
+    }
+    rp->data = map;
+    rp->size = size;
+    rp->rx_pos = header;
+    rp->tx_pos = header;
+    inst->replay = rp;
+    replays_active++;
+    format_name(inst->socket_name, sizeof(inst->socket_name), "%s", path);
+    PRINT("cosim_jtag: replaying: %s\n", path);
+}
+
+// Replay: Compare the replies with the recorded ones, counterpart of
+// flush_socket().
+static void check_replay(instance_t *inst)
+{
+    replay_t *rp = inst->replay;
+    ring_t *ring = &inst->tx_ring;
+    while (ring_count(ring))
+    {
+        while (0 == rp->tx_left)
+        {
+            unsigned long long delta;
+            int type = replay_record(rp, &rp->tx_pos, &delta, &rp->tx_left);
+            if (0 == type)
+            {
+                FAIL("cosim_jtag: replay of %s failed, unexpected reply after %llu bytes\n",
+                     inst->socket_name, rp->tx_bytes);
+            }
+            if (RECORD_TX != type)
+            {
+                rp->tx_pos += rp->tx_left;
+                rp->tx_left = 0;
+            }
+        }
+        char expected = rp->data[rp->tx_pos];
+        char actual = ring_pop(ring);
+        if (expected != actual)
+        {
+            FAIL("cosim_jtag: replay of %s failed, reply byte %llu is 0x%02x instead of 0x%02x (tick %llu)\n",
+                 inst->socket_name, rp->tx_bytes, (unsigned char)actual, (unsigned char)expected, inst->tick);
+        }
+        rp->tx_pos++;
+        rp->tx_left--;
+        rp->tx_bytes++;
+    }
+}
+
+// Replay: Counterpart of refill_socket(). Feeds the next commands once their
+// tick has come, just as they were received while recording.
+static int refill_replay(instance_t *inst)
+{
+    replay_t *rp = inst->replay;
+    ring_t *ring = &inst->rx_ring;
+    check_replay(inst);
+    for (;;)
+    {
+        size_t pos = rp->rx_pos;
+        unsigned long long delta;
+        size_t len;
+        int type = replay_record(rp, &pos, &delta, &len);
+        if (0 == type)
+        {
+            rp->eof = 1;
+            return 0;
+        }
+        if (0 == rp->rx_done && rp->rx_tick + delta > inst->tick)
+        {
+            if (config.nonblock)
+            {
+                inst->skip_hint = config.idle_poll; // as the empty socket did
+            }
+            return 0;
+        }
+        if (RECORD_RX != type)
+        {
+            rp->rx_pos = pos + len;
+            rp->rx_tick += delta;
+            if (RECORD_RESET == type)
+            {
+                reset_connection(inst);
+                return 0;
+            }
+            continue;
+        }
+
+        unsigned int offset = ring->head & RING_MASK;
+        unsigned int space = RING_SIZE - ring_count(ring);
+        if (space > RING_SIZE - offset)
+        {
+            space = RING_SIZE - offset;
+        }
+        unsigned int count = len - rp->rx_done;
+        if (count > space)
+        {
+            count = space; // only if the ring was fuller than while recording
+        }
+        memcpy(&ring->data[offset], &rp->data[pos + rp->rx_done], count);
+        ring_commit(ring, count);
+        rp->rx_done += count;
+        if (rp->rx_done == len)
+        {
+            rp->rx_pos = pos + len;
+            rp->rx_tick += delta;
+            rp->rx_done = 0;
+        }
+        return count;
+    }
+}
+
+// Replay: Returns 1 while there is something left to replay. After the last
+// command was processed all replies must have been checked, once all replays
+// are done the simulation ends.
+static int replay_running(instance_t *inst)
+{
+    replay_t *rp = inst->replay;
+    if (rp->done)
+    {
+        return 0;
+    }
+    if (!rp->eof || ring_count(&inst->rx_ring) || inst->scan.active || inst->vscan.len || inst->pending_read)
+    {
+        return 1;
+    }
+
+    check_replay(inst);
+    size_t pos = rp->tx_pos + rp->tx_left;
+    unsigned long long delta;
+    size_t len;
+    for (int type; 0 != (type = replay_record(rp, &pos, &delta, &len)); pos += len)
+    {
+        if (RECORD_TX == type && len)
+        {
+            FAIL("cosim_jtag: replay of %s failed, replies missing after %llu bytes\n",
+                 inst->socket_name, rp->tx_bytes);
+        }
+    }
+    PRINT("cosim_jtag: replay of %s passed, %llu reply bytes matched\n", inst->socket_name, rp->tx_bytes);
+    rp->done = 1;
+    if (0 == --replays_active)
+    {
+        FINISH();
+    }
+    return 0;
+}
+
+// Endpoint of instance id. Unless set explicitly with COSIM_JTAG_SOCKET_<id>,
+// instance 0 uses COSIM_JTAG_SOCKET as is and all others derive theirs from it:
+// "/tmp/cosim_jtag.sock" becomes "/tmp/cosim_jtag_<id>.sock" and the TCP port
+// is incremented by id, e.g. "tcp:5555" becomes "tcp:<5555 + id>". Port 0 stays
+// 0, every instance then gets its own free port.
+static void instance_path(const char *base, int id, char *path, size_t size)
+{
+    if (0 == id)
+    {
+        format_name(path, size, "%s", base);
+        return;
+    }
+    const char *suffix = strrchr(base, '.');
+    const char *slash = strrchr(base, '/');
+    if (NULL == suffix || (NULL != slash && suffix < slash))
+    {
+        suffix = base + strlen(base); // no file extension
+    }
+    format_name(path, size, "%.*s_%d%s", (int)(suffix - base), base, id, suffix);
+}
+
+static void instance_endpoint(int id, char *endpoint, size_t size)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "COSIM_JTAG_SOCKET_%d", id);
+    const char *base = env_path(name, NULL);
+    if (NULL != base || 0 == id)
+    {
+        format_name(endpoint, size, "%s", NULL != base ? base : config.socket);
+        return;
+    }
+
+    base = config.socket;
+    if (0 == strncmp(base, "tcp:", 4))
+    {
+        const char *port = strrchr(base, ':') + 1;
+        unsigned long number = strtoul(port, NULL, 10);
+        format_name(endpoint, size, "%.*s%lu", (int)(port - base), base, number ? number + id : 0);
+        return;
+    }
+
+    instance_path(base, id, endpoint, size);
+}
+
+#define UNIX_ACCEPTCON 0x00010000 // flag of listening sockets in /proc/net/unix
+
+// Whether some process listens on the UNIX socket at path, according to the
+// kernel's table of UNIX sockets. Unlike a test connection, the listener does
+// not notice. Paths are listed as they were bound, so one bound with a path
+// relative to another working directory is missed.
+static int unix_socket_listening(const char *path)
+{
+    FILE *file = fopen("/proc/net/unix", "r");
+    if (NULL == file)
+    {
+        return 0; // can't tell, assume it's left over
+    }
+    char absolute[PATH_MAX];
+    if (NULL == realpath(path, absolute))
+    {
+        snprintf(absolute, sizeof(absolute), "%s", path);
+    }
+    char line[PATH_MAX + 128];
+    int listening = 0;
+    while (!listening && NULL != fgets(line, sizeof(line), file))
+    {
+        // Num RefCount Protocol Flags Type St Inode [Path]
+        unsigned int flags;
+        int offset = 0;
+        if (1 != sscanf(line, "%*s %*s %*s %x %*s %*s %*s %n", &flags, &offset) || 0 == offset)
+        {
+            continue; // header
+        }
+        char *name = &line[offset];
+        name[strcspn(name, "\n")] = '\0';
+        listening = (flags & UNIX_ACCEPTCON) && (0 == strcmp(name, path) || 0 == strcmp(name, absolute));
+    }
+    fclose(file);
+    return listening;
+}
+
+static void create_unix_socket(instance_t *inst, const char *path)
+{
+    int ret;
+
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        FAIL("cosim_jtag: create_socket path too long for a UNIX socket, at most %zu characters: %s\n",
+             sizeof(addr.sun_path) - 1, path);
+    }
+
+    // A socket left behind by an earlier simulation is replaced. One that is
+    // still in use belongs to a simulation running in parallel, taking it over
+    // would cut off that simulation from its remote.
+    if (unix_socket_listening(path))
+    {
+        FAIL("cosim_jtag: create_socket found %s in use by another simulation, give each its own "
+             "with e.g. COSIM_JTAG_SOCKET=/tmp/cosim_jtag_%%p.sock\n",
+             path);
+    }
+    unlink(path);
+
+    inst->listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (inst->listen_socket == -1)
+    {
+        FAIL("cosim_jtag: create_socket failed to make socket: %s (%d)\n", strerror(errno), errno);
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    format_name(inst->socket_name, sizeof(inst->socket_name), "%s", path);
+    ret = bind(inst->listen_socket, (const struct sockaddr *)&addr,
+               sizeof(struct sockaddr_un));
+    if (ret == -1)
+    {
+        FAIL("cosim_jtag: create_socket failed to bind socket: %s (%d)\n", strerror(errno), errno);
+    }
+}
+
+// Listen on "[<host>:]<port>", host defaults to the IPv4 loopback address,
+// which is what OpenOCD connects to by default. Use e.g. "0.0.0.0:<port>" to
+// accept connections from other machines. Only the first address a host name
+// resolves to is bound, "localhost" may well be just "::1".
+static void create_tcp_socket(instance_t *inst, const char *endpoint)
+{
+    char host[256] = "127.0.0.1";
+    const char *port = strrchr(endpoint, ':');
+    if (NULL == port)
+    {
+        port = endpoint;
+    }
+    else
+    {
+        size_t len = port - endpoint;
+        if (len >= sizeof(host))
+        {
+            FAIL("cosim_jtag: create_socket host name too long: %s\n", endpoint);
+        }
+        memcpy(host, endpoint, len);
+        host[len] = '\0';
+        port++;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0)
+    {
+        FAIL("cosim_jtag: create_socket failed to resolve %s: %s\n", endpoint, gai_strerror(ret));
+    }
+
+    inst->listen_socket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (inst->listen_socket == -1)
+    {
+        FAIL("cosim_jtag: create_socket failed to make socket: %s (%d)\n", strerror(errno), errno);
+    }
+
+    // Allow to restart the simulation right away on the same port.
+    int enable = 1;
+    setsockopt(inst->listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    ret = bind(inst->listen_socket, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret == -1)
+    {
+        FAIL("cosim_jtag: create_socket failed to bind socket: %s (%d)\n", strerror(errno), errno);
+    }
+
+    // Name the port actually bound, with port 0 the kernel picked a free one.
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    unsigned int number = 0;
+    if (0 == getsockname(inst->listen_socket, (struct sockaddr *)&addr, &addr_len))
+    {
+        number = ntohs(AF_INET6 == addr.ss_family ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                                                  : ((struct sockaddr_in *)&addr)->sin_port);
+    }
+    format_name(inst->socket_name, sizeof(inst->socket_name), "%s:%u", host, number);
+}
+
+static void create_socket(instance_t *inst)
+{
+    int ret;
+    char endpoint[PATH_MAX];
+    if (NULL != config.replay)
+    {
+        instance_path(config.replay, inst->id, endpoint, sizeof(endpoint));
+        create_replay(inst, endpoint);
+        return;
+    }
+    instance_endpoint(inst->id, endpoint, sizeof(endpoint));
+
+    if (0 == strncmp(endpoint, "shm:", 4))
+    {
+        create_shm(inst, endpoint + 4);
+        PRINT("cosim_jtag: created shared memory at: %s\n", inst->socket_name);
+        return;
+    }
+    else if (0 == strncmp(endpoint, "tcp:", 4))
+    {
+        inst->socket_is_tcp = 1;
+        create_tcp_socket(inst, endpoint + 4);
+    }
+    else if (0 == strncmp(endpoint, "unix:", 5))
+    {
+        create_unix_socket(inst, endpoint + 5);
+    }
+    else
+    {
+        create_unix_socket(inst, endpoint);
+    }
+
+    // The processing on the socket is called from within GHDL and cannot run
+    // concurrently, we must not block.
+    fcntl(inst->listen_socket, F_SETFL, O_NONBLOCK);
+
+    ret = listen(inst->listen_socket, 0);
+    if (ret == -1)
+    {
+        FAIL("cosim_jtag: create_socket failed to listen on socket: %s (%d)\n", strerror(errno), errno);
+    }
+    if (-1 == watch_socket(inst, inst->listen_socket, 0))
+    {
+        FAIL("cosim_jtag: failed to watch socket with epoll: %s (%d)\n", strerror(errno), errno);
+    }
+
+    PRINT("cosim_jtag: created %s socket at: %s\n", inst->socket_is_tcp ? "tcp" : "unix", inst->socket_name);
+}
+
+// Account for n consumed bytes of command cmd.
+static void stats_command(instance_t *inst, char cmd, unsigned int n)
+{
+    if (!config.stats)
+    {
+        return;
+    }
+    int type = STAT_OTHER;
+    if (cmd >= '0' && cmd <= '7')
+    {
+        type = STAT_WRITE;
+    }
+    else if ('R' == cmd)
+    {
+        type = STAT_READ;
+    }
+    else if (cmd >= 'r' && cmd <= 'u')
+    {
+        type = STAT_RESET;
+    }
+    else if ('X' == cmd || 'x' == cmd)
+    {
+        type = STAT_SCAN;
+    }
+    inst->stats.command_bytes[type] += n;
+    inst->stats.commands += n;
+}
+
+static volatile sig_atomic_t stats_requested = 0;
+static unsigned long long stats_started = 0; // ns, first call into C
+
+static void stats_signal(int signum)
+{
+    (void)signum;
+    stats_requested = 1; // printed by the next tick, PRINT is not signal safe
+}
+
+static void stats_print(instance_t *inst)
+{
+    stats_t *st = &inst->stats;
+    uint64_t rx_syscalls = __atomic_load_n(&st->rx_syscalls, __ATOMIC_RELAXED);
+    uint64_t tx_syscalls = __atomic_load_n(&st->tx_syscalls, __ATOMIC_RELAXED);
+    uint64_t rx_bytes = __atomic_load_n(&st->rx_bytes, __ATOMIC_RELAXED);
+    uint64_t tx_bytes = __atomic_load_n(&st->tx_bytes, __ATOMIC_RELAXED);
+    double wall = (monotonic_ns() - stats_started) / 1e9;
+    // Every read request and every bit of a packed scan is one shifted bit.
+    uint64_t bits = st->command_bytes[STAT_READ] + st->scan_bits;
+
+    PRINT("cosim_jtag: stats of instance %d (%s) after %.3f s\n", inst->id, inst->socket_name, wall);
+    PRINT("  ticks:    %llu, %llu with commands, %llu without\n", (unsigned long long)st->ticks,
+          (unsigned long long)st->busy_ticks, (unsigned long long)(st->ticks - st->busy_ticks));
+    PRINT("  commands: %llu bytes: write %llu, read %llu, reset %llu, scan %llu, other %llu\n",
+          (unsigned long long)st->commands, (unsigned long long)st->command_bytes[STAT_WRITE],
+          (unsigned long long)st->command_bytes[STAT_READ], (unsigned long long)st->command_bytes[STAT_RESET],
+          (unsigned long long)st->command_bytes[STAT_SCAN], (unsigned long long)st->command_bytes[STAT_OTHER]);
+    PRINT("  syscalls: read %llu (%llu bytes), send %llu (%llu bytes)\n", (unsigned long long)rx_syscalls,
+          (unsigned long long)rx_bytes, (unsigned long long)tx_syscalls, (unsigned long long)tx_bytes);
+    PRINT("  bits:     %llu shifted, %.0f per wall second\n", (unsigned long long)bits,
+          wall > 0 ? bits / wall : 0.0);
+    PRINT("  tick:     %.1f ns on average, %.3f s in total\n",
+          st->ticks ? (double)st->tick_ns / st->ticks : 0.0, st->tick_ns / 1e9);
+    for (int i = 0; i < STAT_TICK_BUCKETS; ++i)
+    {
+        if (st->tick_hist[i])
+        {
+            PRINT("    %s%8llu ns: %llu\n", (i == STAT_TICK_BUCKETS - 1) ? ">=" : "< ",
+                  1ULL << (i + (i != STAT_TICK_BUCKETS - 1)), (unsigned long long)st->tick_hist[i]);
+        }
+    }
+}
+
+static void stats_print_all(void)
+{
+    for (int i = 0; i < MAX_INSTANCES; ++i)
+    {
+        if (NULL != instances[i])
+        {
+            stats_print(instances[i]);
+        }
+    }
+}
+
+// Start timing a tick.
+static void stats_begin(instance_t *inst)
+{
+    inst->stats.tick_start = monotonic_ns();
+    inst->stats.tick_commands = inst->stats.commands;
+}
+
+// Finish timing a tick, also prints the stats if requested by SIGUSR1.
+static void stats_end(instance_t *inst)
+{
+    stats_t *st = &inst->stats;
+    uint64_t ns = monotonic_ns() - st->tick_start;
+    int bucket = 0;
+    while (bucket < STAT_TICK_BUCKETS - 1 && ns >= (2ULL << bucket))
+    {
+        bucket++;
+    }
+    st->tick_hist[bucket]++;
+    st->tick_ns += ns;
+    st->ticks++;
+    if (st->commands != st->tick_commands)
+    {
+        st->busy_ticks++;
+    }
+    if (stats_requested)
+    {
+        stats_requested = 0;
+        stats_print_all();
+    }
+}
+
+static void stats_start(void)
+{
+    stats_started = monotonic_ns();
+    signal(SIGUSR1, stats_signal);
+#ifndef USE_VHPI
+    atexit(stats_print_all); // VHPI prints them in end_vhpi() instead
+#endif
+}
+
+// Live telemetry, see cosim_jtag_telemetry.h. One page for all instances,
+// each publishes to its own slot.
+static cosim_jtag_telemetry_t *telemetry = NULL;
+
+static void create_telemetry(const char *name)
+{
+    // Same as for the transport. Monitors of a simulation that still runs would
+    // silently be switched over to this one otherwise.
+    if (shm_owner_alive(name, COSIM_JTAG_TELEMETRY_MAGIC, offsetof(cosim_jtag_telemetry_t, pid)))
+    {
+        FAIL("cosim_jtag: create_telemetry found %s in use by another simulation, give each its own "
+             "with e.g. COSIM_JTAG_TELEMETRY=/cosim_jtag_telemetry_%%p\n",
+             name);
+    }
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        FAIL("cosim_jtag: create_telemetry failed to open shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+    if (-1 == ftruncate(fd, sizeof(cosim_jtag_telemetry_t)))
+    {
+        FAIL("cosim_jtag: create_telemetry failed to resize shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+    void *map = mmap(NULL, sizeof(cosim_jtag_telemetry_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        FAIL("cosim_jtag: create_telemetry failed to map shared memory: %s (%d)\n", strerror(errno), errno);
+    }
+
+    // Freshly truncated memory is zeroed, i.e. all slots unused.
+    telemetry = (cosim_jtag_telemetry_t *)map;
+    telemetry->version = COSIM_JTAG_TELEMETRY_VERSION;
+    telemetry->pid = (uint32_t)getpid();
+    __atomic_store_n(&telemetry->magic, COSIM_JTAG_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Update the slot of the instance. Readers retry on their own if they raced
+// with this, see cosim_jtag_telemetry_read(). Nothing ever waits on them.
+static void publish_telemetry(instance_t *inst, int connected)
+{
+    cosim_jtag_telemetry_slot_t *slot = &telemetry->slots[inst->id];
+    uint64_t now = monotonic_ns();
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->state = connected ? COSIM_JTAG_TELEMETRY_CONNECTED : COSIM_JTAG_TELEMETRY_WAITING;
+    slot->tap = inst->tap;
+    slot->rx_queue = ring_count(&inst->rx_ring);
+    slot->tx_queue = ring_count(&inst->tx_ring);
+    slot->time_ns = now;
+    slot->ticks = inst->tick;
+    slot->dry = inst->dry;
+    slot->cycles = inst->cycles;
+    if (0 != inst->telemetry_ns && now != inst->telemetry_ns)
+    {
+        double seconds = (now - inst->telemetry_ns) / 1e9;
+        slot->ticks_per_s = (uint64_t)((inst->tick - inst->telemetry_ticks) / seconds);
+        slot->cycles_per_s = (uint64_t)((inst->cycles - inst->telemetry_cycles) / seconds);
+    }
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    inst->telemetry_ns = now;
+    inst->telemetry_ticks = inst->tick;
+    inst->telemetry_cycles = inst->cycles;
+}
+
+// Get instance of given id, creates it (and its socket) on first use.
+static instance_t *get_instance(int id)
+{
+    if (id < 0 || id >= MAX_INSTANCES)
+    {
+        FAIL("cosim_jtag: instance id %d is out of range 0 to %d\n", id, MAX_INSTANCES - 1);
+    }
+    if (NULL != instances[id])
+    {
+        return instances[id];
+    }
+
+    if (!config_loaded)
+    {
+        load_config();
+        if (config.stats)
+        {
+            stats_start();
+        }
+        if (NULL != config.telemetry)
+        {
+            create_telemetry(config.telemetry);
+        }
+    }
+    if (epoll_fd == -1)
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1)
+        {
+            FAIL("cosim_jtag: failed to create epoll instance: %s (%d)\n", strerror(errno), errno);
+        }
+        if (config.thread)
+        {
+            start_io_thread();
+        }
+    }
+
+    instance_t *inst = calloc(1, sizeof(instance_t));
+    if (NULL == inst)
+    {
+        FAIL("cosim_jtag: failed to allocate instance %d\n", id);
+    }
+    inst->id = id;
+    inst->listen_socket = -1;
+    inst->data_socket = -1;
+    inst->state = (state_t){HDL_X, HDL_X, HDL_X, HDL_0, HDL_0};
+    inst->driven = (state_t){HDL_U, HDL_U, HDL_U, HDL_U, HDL_U};
+    inst->tap = TAP_RESET;
+    inst->tap_tck = HDL_X;
+    inst->dtm.ir = DTM_IR_IDCODE;
+    inst->acceptable = 1; // OpenOCD may already be waiting
+    __atomic_store_n(&instances[id], inst, __ATOMIC_RELEASE); // I/O thread
+    instance_count++;
+
+    // Create and open a named file socked.
+    create_socket(inst);
+    if (NULL != config.record && NULL == config.replay)
+    {
+        char path[PATH_MAX];
+        instance_path(config.record, id, path, sizeof(path));
+        open_record(inst, path);
+    }
+    return inst;
+}
+
+static void accept_connection(instance_t *inst)
+{
+    // Most simulations never see a debugger. Only ask for new connections
+    // every accept_interval ms, a failed accept() per tick adds up otherwise.
+    if (!inst->acceptable)
+    {
+        unsigned long long now = monotonic_ms();
+        if (now - accept_polled < config.accept_interval)
+        {
+            return;
+        }
+        accept_polled = now;
+        poll_sockets(0);
+        if (!inst->acceptable)
+        {
+            return;
+        }
+    }
+    inst->data_socket = accept(inst->listen_socket, NULL, NULL);
+    if (inst->data_socket == -1)
+    {
+        inst->acceptable = 0;
+        if (errno != EAGAIN)
+        {
+            FAIL("cosim_jtag: accept_connection failed with: %s (%d)\n", strerror(errno), errno);
+        }
+    }
+    else
+    {
+        if (-1 == watch_socket(inst, inst->data_socket, EVENT_DATA_SOCKET))
+        {
+            FAIL("cosim_jtag: failed to watch socket with epoll: %s (%d)\n", strerror(errno), errno);
+        }
+        inst->readable = 1; // OpenOCD may have sent something already
+        // Accepted sockets do not inherit O_NONBLOCK of the listening socket.
+        if (config.nonblock)
+        {
+            fcntl(inst->data_socket, F_SETFL, O_NONBLOCK);
+        }
+        // Replies are already batched, don't let the kernel delay them more.
+        if (inst->socket_is_tcp)
+        {
+            int enable = 1;
+            setsockopt(inst->data_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+        PRINT("cosim_jtag: remote connected to %s\n", inst->socket_name);
+    }
+}
+
+// Anything left of the commands restored from a checkpoint.
+static int restored_pending(const instance_t *inst)
+{
+    return ring_count(&inst->rx_ring) || inst->scan.active || inst->vscan.len || inst->pending_read;
+}
+
+static void end_restored(instance_t *inst)
+{
+    PRINT("cosim_jtag: played out commands restored from checkpoint on %s\n", inst->socket_name);
+    inst->restored = 0;
+    reset_connection(inst);
+}
+
+static void close_connection(instance_t *inst)
+{
+    PRINT("cosim_jtag: remote disconnected from %s\n", inst->socket_name);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, inst->data_socket, NULL);
+    close(inst->data_socket);
+    inst->data_socket = -1;
+    inst->readable = 0;
+    reset_connection(inst);
+}
+
+// Follow the TAP state machine over one edge of tck.
+static void tap_clock(instance_t *inst, const state_t *state)
+{
+    if (HDL_1 == state->trst)
+    {
+        inst->tap = TAP_RESET; // asynchronous, active-high
+    }
+    else if (HDL_1 == state->tck && HDL_1 != inst->tap_tck)
+    {
+        inst->tap = tap_next[inst->tap][HDL_TO_INT(state->tms)];
+        inst->cycles++;
+    }
+    inst->tap_tck = state->tck;
+}
+
+// OpenOCD clocks in Run-Test/Idle, Pause or Test-Logic-Reset by sending the
+// same two writes, tck low and high with constant tms and tdi, over and over.
+// Consume such a run from what is already buffered and return its length in
+// edges. VHDL toggles tck that often on its own, no need to call in for each.
+// Only valid right after a write, when tck, tms and tdi are known.
+static unsigned int collapse_clocks(instance_t *inst, state_t *state)
+{
+    ring_t *rx = &inst->rx_ring;
+    if (inst->scan.active || inst->pending_read)
+    {
+        return 0;
+    }
+    char write = '0' + (HDL_TO_INT(state->tms) << 1 | HDL_TO_INT(state->tdi));
+    unsigned int tck = HDL_TO_INT(state->tck) ^ 1; // of the next expected write
+    unsigned int count = ring_count(rx);
+    unsigned int edges = 0;
+    while (edges < count && edges < 8 && ring_peek(rx, edges) == (char)(write | tck << 2))
+    {
+        tck ^= 1;
+        edges++;
+    }
+    if (8 == edges)
+    {
+        // A long run, e.g. idling in Run-Test/Idle. Match it eight at once.
+        uint64_t pattern = BYTES(write) | (BYTES(tck << 2) & 0x00ff00ff00ff00ffull) |
+                           (BYTES((tck ^ 1) << 2) & 0xff00ff00ff00ff00ull);
+        edges = ring_match(rx, RING_SIZE, pattern, BYTES(0xff));
+        tck ^= edges & 1;
+    }
+    if (0 == edges)
+    {
+        return 0;
+    }
+    ring_drop(rx, edges);
+    stats_command(inst, write, edges);
+
+    // tms is constant, after a few rising edges the state does not change. So
+    // is trst, any reset command ends the run. While it is asserted the TAP is
+    // held in Test-Logic-Reset, as in tap_clock().
+    unsigned int rising = (edges + (HDL_TO_INT(state->tck) ^ 1)) / 2;
+    inst->cycles += rising;
+    if (HDL_1 == state->trst)
+    {
+        inst->tap = TAP_RESET;
+    }
+    for (unsigned int i = 0; i < rising && i < 8 && HDL_1 != state->trst; ++i)
+    {
+        inst->tap = tap_next[inst->tap][HDL_TO_INT(state->tms)];
+    }
+    state->tck = INT_TO_HDL(tck ^ 1);
+    inst->tap_tck = state->tck;
+    return edges;
+}
+
+// Bits of the changed mask returned from tick.
+#define CHANGED_TCK (1 << 0)
+#define CHANGED_TMS (1 << 1)
+#define CHANGED_TDI (1 << 2)
+#define CHANGED_TRST (1 << 3)
+#define CHANGED_SRST (1 << 4)
+#define CHANGED_SECOND_SHIFT 5 // same for tck2, tms2 and tdi2, relative to tck...
+
+static int changed_mask(const state_t *now, const state_t *last)
+{
+    return (now->tck != last->tck ? CHANGED_TCK : 0) |
+           (now->tms != last->tms ? CHANGED_TMS : 0) |
+           (now->tdi != last->tdi ? CHANGED_TDI : 0) |
+           (now->trst != last->trst ? CHANGED_TRST : 0) |
+           (now->srst != last->srst ? CHANGED_SRST : 0);
+}
+
+static void store_pins(const state_t *state, char *pins)
+{
+    pins[0] = state->tck;
+    pins[1] = state->tms;
+    pins[2] = state->tdi;
+    pins[3] = state->trst;
+    pins[4] = state->srst;
+}
+
+// Send all buffered replies to OpenOCD. Waits for the socket to become
+// writable should the kernel buffer ever be full.
+static void transmit_socket(instance_t *inst)
+{
+    if (NULL != inst->shm)
+    {
+        flush_shm(inst);
+        return;
+    }
+    if (config.thread)
+    {
+        flush_thread(inst);
+        return;
+    }
+    ring_t *ring = &inst->tx_ring;
+    while (ring_count(ring))
+    {
+        int ret = ring_send(inst->data_socket, ring);
+        STAT_ADD(inst, tx_syscalls, 1);
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd pfd = {inst->data_socket, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (errno == EPIPE || errno == ECONNRESET)
+            {
+                close_connection(inst);
+                return;
+            }
+            FAIL("cosim_jtag: process_socket failed to write: %s (%d)\n", strerror(errno), errno);
+        }
+        ring_drop(ring, ret);
+        STAT_ADD(inst, tx_bytes, ret);
+    }
+}
+
+// Hand all buffered replies to the remote, recording them if requested.
+static void flush_socket(instance_t *inst)
+{
+    ring_t *ring = &inst->tx_ring;
+    if (NULL != inst->record && ring->head != inst->record_tx)
+    {
+        record_event(inst, RECORD_TX, ring, inst->record_tx, ring->head - inst->record_tx);
+        inst->record_tx = ring->head;
+    }
+    if (NULL != inst->replay)
+    {
+        check_replay(inst);
+        return;
+    }
+    if (inst->restored)
+    {
+        ring_drop(ring, ring_count(ring)); // the remote is gone
+        return;
+    }
+    transmit_socket(inst);
+}
+
+// Fill the receive ring with as much data as the socket has available, with a
+// single read even where the ring wraps. Returns the number of bytes received,
+// 0 if there was nothing to receive or the remote closed the connection.
+static int receive_socket(instance_t *inst)
+{
+    if (NULL != inst->shm)
+    {
+        return refill_shm(inst);
+    }
+    if (config.thread)
+    {
+        return refill_thread(inst);
+    }
+
+    // OpenOCD may wait on our replies before sending anything new. Send them
+    // now, before we possibly block on reading.
+    flush_socket(inst);
+    if (inst->data_socket == -1)
+    {
+        return 0; // remote closed while sending
+    }
+
+    // Without blocking, only read sockets that have something to read.
+    if (config.nonblock && !socket_ready(&inst->readable))
+    {
+        inst->skip_hint = config.idle_poll;
+        return 0;
+    }
+
+    ring_t *ring = &inst->rx_ring;
+    int ret = ring_receive(inst->data_socket, ring);
+    STAT_ADD(inst, rx_syscalls, 1);
+    if (ret == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // Non-blocking and nothing pending, don't ask again for a while.
+            inst->readable = 0;
+            inst->skip_hint = config.idle_poll;
+            return 0;
+        }
+        FAIL("cosim_jtag: process_socket failed to read: %s (%d)\n", strerror(errno), errno);
+    }
+
+    if (ret == 0)
+    {
+        close_connection(inst);
+        return 0;
+    }
+
+    ring_commit(ring, ret);
+    STAT_ADD(inst, rx_bytes, ret);
+    return ret;
+}
+
+// Non-blocking mode: Sleep until the connected remote sends something, but at
+// most idle_sleep ms. Returns 1 if there might be something to receive now.
+static int idle_sleep(instance_t *inst)
+{
+    if (NULL != inst->shm)
+    {
+        cosim_jtag_shm_ring_t *to_sim = &inst->shm->to_sim;
+        if (!shm_attached(inst))
+        {
+            return 0;
+        }
+        cosim_jtag_shm_wait(to_sim, __atomic_load_n(&to_sim->head, __ATOMIC_ACQUIRE),
+                            config.idle_sleep * 1000000L);
+        return 0 != cosim_jtag_shm_count(to_sim);
+    }
+    if (config.thread)
+    {
+        if (LINK_UP != __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE))
+        {
+            return 0;
+        }
+        wait_thread(inst, config.idle_sleep * 1000000L);
+        return 0 != ring_count(&inst->rx_ring);
+    }
+    if (inst->data_socket == -1)
+    {
+        return 0;
+    }
+    poll_sockets(config.idle_sleep);
+    return inst->readable;
+}
+
+// Fill the receive ring from the remote or the replay, recording what was
+// received if requested.
+static int refill_socket(instance_t *inst)
+{
+    if (NULL != inst->replay)
+    {
+        return refill_replay(inst);
+    }
+    if (inst->restored)
+    {
+        end_restored(inst); // rest of the command never arrived
+        return 0;
+    }
+    int ret = receive_socket(inst);
+    if (0 == ret && config.nonblock && config.idle_sleep)
+    {
+        // Don't burn a core while the remote idles, e.g. with GDB sitting at a
+        // breakpoint. Simulation time then only advances slowly.
+        if (inst->idle_refills < config.idle_sleep_after)
+        {
+            inst->idle_refills++;
+        }
+        else if (idle_sleep(inst))
+        {
+            inst->skip_hint = 0;
+            ret = receive_socket(inst);
+        }
+    }
+    if (ret > 0)
+    {
+        inst->idle_refills = 0;
+    }
+    if (NULL != inst->record && ret > 0)
+    {
+        // The I/O thread may have received even more in the meantime.
+        unsigned int head = __atomic_load_n(&inst->rx_ring.head, __ATOMIC_ACQUIRE);
+        record_event(inst, RECORD_RX, &inst->rx_ring, inst->record_rx, head - inst->record_rx);
+        inst->record_rx = head;
+    }
+    return ret;
+}
+
+// Command decoder from here on. It only ever works on the rings of the
+// instance, never on the transport. Whatever it needs from there is requested
+// from the I/O stage, see exchange_socket().
+
+// Make sure that at least count bytes are buffered in the receive ring.
+// Returns 0 if they are not (yet) available.
+static int require_rx(instance_t *inst, unsigned int count)
+{
+    if (ring_count(&inst->rx_ring) < count)
+    {
+        inst->rx_need = count;
+        return 0;
+    }
+    return 1;
+}
+
+#define SCAN_BIT(vec, i) (((vec)[(i) >> 3] >> ((i) & 7)) & 1)
+
+// Parse a packed scan request from the receive ring. Returns 0 if the request
+// has not been fully received yet.
+static int start_scan(instance_t *inst)
+{
+    ring_t *rx = &inst->rx_ring;
+    scan_t *scan = &inst->scan;
+    if (!require_rx(inst, 3))
+    {
+        return 0;
+    }
+    unsigned int cmd = (unsigned char)ring_peek(rx, 0);
+    unsigned int len = (unsigned char)ring_peek(rx, 1) |
+                       (unsigned char)ring_peek(rx, 2) << 8;
+    unsigned int bytes = (len + 7) / 8;
+    if (len > SCAN_MAX_BITS)
+    {
+        FAIL("cosim_jtag: scan of %u bits exceeds the maximum of %u bits\n", len, SCAN_MAX_BITS);
+    }
+    if (!require_rx(inst, 3 + 2 * bytes))
+    {
+        return 0;
+    }
+
+    ring_drop(rx, 3);
+    stats_command(inst, cmd, 3 + 2 * bytes);
+    STAT_ADD(inst, scan_bits, len);
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        scan->tms[i] = ring_pop(rx);
+    }
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        scan->tdi[i] = ring_pop(rx);
+        scan->tdo[i] = 0;
+    }
+    scan->capture = (cmd == 'X');
+    scan->len = len;
+    scan->pos = 0;
+    scan->phase = 0;
+    scan->active = (len != 0);
+    return 1;
+}
+
+// Queue reply to a read request.
+static void reply_read(instance_t *inst, char tdo)
+{
+    ring_push(&inst->tx_ring, HDL_TO_INT(tdo) ? '1' : '0');
+}
+
+// Apply a write command '0' to '7'.
+static void apply_write(state_t *state, char cmd)
+{
+    char val = cmd - '0';
+    state->tck = INT_TO_HDL(val & 0b100);
+    state->tms = INT_TO_HDL(val & 0b010);
+    state->tdi = INT_TO_HDL(val & 0b001);
+}
+
+// All bits of the active scan were shifted, reply captured tdo if requested.
+static void finish_scan(instance_t *inst)
+{
+    scan_t *scan = &inst->scan;
+    scan->active = 0;
+    if (scan->capture)
+    {
+        for (unsigned int i = 0; i < (scan->len + 7) / 8; ++i)
+        {
+            ring_push(&inst->tx_ring, scan->tdo[i]);
+        }
+    }
+}
+
+// Play out one edge of the active scan.
+static void step_scan(instance_t *inst, char tdo, state_t *state)
+{
+    scan_t *scan = &inst->scan;
+    if (0 == scan->phase)
+    {
+        state->tck = HDL_0;
+        state->tms = INT_TO_HDL(SCAN_BIT(scan->tms, scan->pos));
+        state->tdi = INT_TO_HDL(SCAN_BIT(scan->tdi, scan->pos));
+        scan->phase = 1;
+        return;
+    }
+
+    // tdo is valid since the falling edge of the previous tick
+    scan->tdo[scan->pos >> 3] |= HDL_TO_INT(tdo) << (scan->pos & 7);
+    state->tck = HDL_1;
+    scan->phase = 0;
+    if (++scan->pos < scan->len)
+    {
+        return;
+    }
+
+    finish_scan(inst);
+}
+
+// Shift engine: Four classic bits without a read are eight writes, tck low and
+// high with the same tms and tdi each. Check and translate them at once, if
+// they are contiguous in the receive ring. Returns 0 if they are not.
+static int vscan_quad(const ring_t *rx, unsigned int index, char *scan_tms, char *scan_tdi)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    unsigned int offset = (rx->tail + index) & RING_MASK;
+    uint64_t word;
+    if (offset > RING_SIZE - sizeof(word))
+    {
+        return 0;
+    }
+    memcpy(&word, &rx->data[offset], sizeof(word));
+    // '0' to '3' followed by the same plus tck, that is '4' to '7'
+    if ((word & BYTES(0xfc)) != (BYTES('0') | 0x0400040004000400ull) ||
+        0 != ((word ^ word >> 8) & 0x0003000300030003ull))
+    {
+        return 0;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        unsigned int val = word >> (16 * i);
+        scan_tms[i] = INT_TO_HDL(val & 0b10);
+        scan_tdi[i] = INT_TO_HDL(val & 0b01);
+    }
+    return 1;
+#else
+    (void)rx, (void)index, (void)scan_tms, (void)scan_tdi;
+    return 0;
+#endif
+}
+
+// Shift engine: Hand the next bits over to VHDL. These are either a chunk of
+// the active packed scan or a run of classic bits, each consisting of a write
+// with tck low, an optional read and the write with tck high, just as OpenOCD
+// sends them for every shifted bit. Per bit VHDL drives tck low together with
+// tms and tdi, samples tdo and drives tck high on the next tick, the same as
+// step_scan() does. Returns the number of bits handed over.
+static unsigned int start_vscan(instance_t *inst, state_t *state, char *scan_tms, char *scan_tdi)
+{
+    ring_t *rx = &inst->rx_ring;
+    scan_t *scan = &inst->scan;
+    vscan_t *vscan = &inst->vscan;
+    unsigned int len = 0;
+
+    if (!scan->active && ring_count(rx) && ('X' == ring_peek(rx, 0) || 'x' == ring_peek(rx, 0)))
+    {
+        if (!start_scan(inst) || !scan->active)
+        {
+            return 0; // not yet fully received or empty
+        }
+    }
+
+    if (scan->active)
+    {
+        if (0 != scan->phase)
+        {
+            return 0; // let step_scan() finish the current bit
+        }
+        len = scan->len - scan->pos;
+        if (len > VSCAN_BITS)
+        {
+            len = VSCAN_BITS;
+        }
+        for (unsigned int i = 0; i < len; ++i)
+        {
+            scan_tms[i] = INT_TO_HDL(SCAN_BIT(scan->tms, scan->pos + i));
+            scan_tdi[i] = INT_TO_HDL(SCAN_BIT(scan->tdi, scan->pos + i));
+        }
+        vscan->packed = 1;
+    }
+    else
+    {
+        unsigned int count = ring_count(rx);
+        unsigned int p = 0;
+        unsigned int read = 0;
+        while (len < VSCAN_BITS && p + 2 <= count)
+        {
+            // Bits nobody reads tend to come in bulk, take four at once.
+            if (!read && len + 4 <= VSCAN_BITS && p + 8 <= count &&
+                vscan_quad(rx, p, &scan_tms[len], &scan_tdi[len]))
+            {
+                memset(&vscan->read[len], 0, 4);
+                len += 4;
+                p += 8;
+                continue;
+            }
+            char low = ring_peek(rx, p);
+            if (low < '0' || low > '3')
+            {
+                break;
+            }
+            read = ('R' == ring_peek(rx, p + 1));
+            if (p + 2 + read > count || ring_peek(rx, p + 1 + read) != low + 4)
+            {
+                break;
+            }
+            scan_tms[len] = INT_TO_HDL((low - '0') & 0b10);
+            scan_tdi[len] = INT_TO_HDL((low - '0') & 0b01);
+            vscan->read[len] = read;
+            len++;
+            p += 2 + read;
+        }
+        if (len < VSCAN_MIN_BITS)
+        {
+            return 0;
+        }
+        ring_drop(rx, p);
+        stats_command(inst, 'R', p - 2 * len);
+        stats_command(inst, '0', 2 * len);
+        vscan->packed = 0;
+    }
+
+    for (unsigned int i = 0; i < len; ++i)
+    {
+        inst->tap = tap_next[inst->tap][HDL_TO_INT(scan_tms[i])];
+    }
+    inst->cycles += len;
+    state->tck = HDL_1;
+    state->tms = scan_tms[len - 1];
+    state->tdi = scan_tdi[len - 1];
+    inst->tap_tck = HDL_1;
+    vscan->len = len;
+    return len;
+}
+
+// Shift engine: VHDL is done with the last bits, process the sampled tdo.
+static void finish_vscan(instance_t *inst, const char *scan_tdo)
 {
-    int ret;
+    vscan_t *vscan = &inst->vscan;
+    if (vscan->packed)
+    {
+        scan_t *scan = &inst->scan;
+        for (unsigned int i = 0; i < vscan->len; ++i, ++scan->pos)
+        {
+            scan->tdo[scan->pos >> 3] |= HDL_TO_INT(scan_tdo[i]) << (scan->pos & 7);
+        }
+        if (scan->pos == scan->len)
+        {
+            finish_scan(inst);
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < vscan->len; ++i)
+        {
+            if (vscan->read[i])
+            {
+                reply_read(inst, scan_tdo[i]);
+            }
+        }
+    }
+    vscan->len = 0;
+}
+
+// Process one command. Returns 1 if the command was a write to tck, tms and
+// tdi (or a step of a packed scan), 0 for everything else.
+static int process_socket(instance_t *inst, char tdo, state_t *state)
+{
+    ring_t *rx = &inst->rx_ring;
+    char buffer, val;
+
+    // A packed scan gets played out over multiple ticks.
+    if (inst->scan.active)
+    {
+        step_scan(inst, tdo, state);
+        return 1;
+    }
+
+    // Only go to the socket if all previously received data was processed.
+    // OpenOCD usually sends many commands at once, so most ticks get served
+    // from the buffer without a syscall.
+    if (0 == ring_count(rx))
+    {
+        inst->rx_need = 1;
+        return 0;
+    }
+    buffer = ring_peek(rx, 0);
+
+    // Extended protocol: packed scans carry their payload along. Wait until
+    // they are completely received and then start shifting.
+    if (buffer == 'X' || buffer == 'x')
+    {
+        if (start_scan(inst) && inst->scan.active)
+        {
+            step_scan(inst, tdo, state);
+            return 1;
+        }
+        return 0;
+    }
+    ring_drop(rx, 1);
+    stats_command(inst, buffer, 1);
+
+    // process received byte, protocol according to openocd docs:
+    // https://github.com/openocd-org/openocd/blob/master/doc/manual/jtag/drivers/remote_bitbang.txt
+    switch (buffer)
+    {
+    case 'B': // Blink on
+    case 'b': // Blink off
+        break;
+    case 'R': // Read request
+        reply_read(inst, tdo);
+        break;
+    case 'Q': // Quit request
+        inst->quit = 1;
+        break;
+    case '0': // Write 0 0 0
+    case '1': // Write 0 0 1
+    case '2': // Write 0 1 0
+    case '3': // Write 0 1 1
+    case '4': // Write 1 0 0
+    case '5': // Write 1 0 1
+    case '6': // Write 1 1 0
+    case '7': // Write 1 1 1
+        apply_write(state, buffer);
+        return 1;
+    case 'r': // Reset 0 0
+    case 's': // Reset 0 1
+    case 't': // Reset 1 0
+    case 'u': // Reset 1 1
+        val = buffer - 'r';
+        state->trst = INT_TO_HDL(val & 0b10);
+        state->srst = INT_TO_HDL(val & 0b01);
+    default:
+        break;
+    }
+    return 0;
+}
+
+// DMI mode: Load the data register selected by the current instruction.
+static void dtm_capture_dr(dtm_t *dtm)
+{
+    switch (dtm->ir)
+    {
+    case DTM_IR_IDCODE:
+        dtm->dr_shift = config.dmi_idcode;
+        dtm->dr_len = 32;
+        break;
+    case DTM_IR_DTMCS:
+        // version 0.13, no idle cycles required, sticky error in dmistat
+        dtm->dr_shift = (dtm->status ? 3 : 0) << 10 | DMI_ABITS << 4 | 1;
+        dtm->dr_len = 32;
+        break;
+    case DTM_IR_DMI:
+        dtm->dr_shift = (uint64_t)dtm->addr << 34 | (uint64_t)dtm->data << 2 | dtm->status;
+        dtm->dr_len = DMI_LEN;
+        break;
+    default: // BYPASS
+        dtm->dr_shift = 0;
+        dtm->dr_len = 1;
+        break;
+    }
+}
+
+static void dtm_update_dr(dtm_t *dtm)
+{
+    if (DTM_IR_DTMCS == dtm->ir)
+    {
+        if (dtm->dr_shift & (3 << 16)) // dmireset or dmihardreset
+        {
+            dtm->status = 0;
+        }
+    }
+    else if (DTM_IR_DMI == dtm->ir)
+    {
+        unsigned int op = dtm->dr_shift & 3;
+        if ((DMI_OP_READ == op || DMI_OP_WRITE == op) && 0 == dtm->status)
+        {
+            dtm->req_op = op;
+            dtm->req_data = (uint32_t)(dtm->dr_shift >> 2);
+            dtm->req_addr = (unsigned int)(dtm->dr_shift >> 34) & ((1 << DMI_ABITS) - 1);
+            dtm->request = 1;
+        }
+    }
+}
+
+// DMI mode: Rising edge of tck.
+static void dtm_clock(instance_t *inst, unsigned int tms, unsigned int tdi)
+{
+    dtm_t *dtm = &inst->dtm;
+    switch (inst->tap)
+    {
+    case TAP_DRCAPTURE:
+        dtm_capture_dr(dtm);
+        break;
+    case TAP_DRSHIFT:
+        dtm->dr_shift = dtm->dr_shift >> 1 | (uint64_t)tdi << (dtm->dr_len - 1);
+        break;
+    case TAP_IRCAPTURE:
+        dtm->ir_shift = 0b00001;
+        break;
+    case TAP_IRSHIFT:
+        dtm->ir_shift = dtm->ir_shift >> 1 | tdi << (DTM_IR_LEN - 1);
+        break;
+    default:
+        break;
+    }
+
+    inst->tap = tap_next[inst->tap][tms];
+    inst->cycles++;
+    switch (inst->tap)
+    {
+    case TAP_RESET:
+        dtm->ir = DTM_IR_IDCODE;
+        break;
+    case TAP_DRUPDATE:
+        dtm_update_dr(dtm);
+        break;
+    case TAP_IRUPDATE:
+        dtm->ir = dtm->ir_shift;
+        break;
+    default:
+        break;
+    }
+}
+
+// DMI mode: tdo as it is after the last falling edge of tck.
+static char dtm_tdo(instance_t *inst)
+{
+    if (TAP_DRSHIFT == inst->tap)
+    {
+        return INT_TO_HDL(inst->dtm.dr_shift & 1);
+    }
+    if (TAP_IRSHIFT == inst->tap)
+    {
+        return INT_TO_HDL(inst->dtm.ir_shift & 1);
+    }
+    return HDL_0;
+}
+
+// DMI mode: There is no TAP to drive, the emulated DTM answers right away. So
+// process commands as long as there are any, or until a DMI access has to be
+// carried out by VHDL. Packed scans get paused in that case.
+static void process_dmi(instance_t *inst)
+{
+    ring_t *rx = &inst->rx_ring;
+    scan_t *scan = &inst->scan;
+    state_t *state = &inst->state;
+    while (!inst->dtm.request)
+    {
+        if (ring_count(&inst->tx_ring) >= TX_FLUSH_THRESHOLD)
+        {
+            return; // let the I/O stage send them first
+        }
+        if (scan->active)
+        {
+            while (scan->pos < scan->len && !inst->dtm.request)
+            {
+                scan->tdo[scan->pos >> 3] |= HDL_TO_INT(dtm_tdo(inst)) << (scan->pos & 7);
+                dtm_clock(inst, SCAN_BIT(scan->tms, scan->pos), SCAN_BIT(scan->tdi, scan->pos));
+                scan->pos++;
+            }
+            if (scan->pos == scan->len)
+            {
+                state->tck = HDL_1;
+                finish_scan(inst);
+            }
+            continue;
+        }
+
+        if (0 == ring_count(rx))
+        {
+            inst->rx_need = 1;
+            return;
+        }
+        char cmd = ring_peek(rx, 0);
+        if ('X' == cmd || 'x' == cmd)
+        {
+            if (!start_scan(inst))
+            {
+                return;
+            }
+            continue;
+        }
+        ring_drop(rx, 1);
+        stats_command(inst, cmd, 1);
+
+        switch (cmd)
+        {
+        case 'R':
+            reply_read(inst, dtm_tdo(inst));
+            break;
+        case 'Q':
+            inst->quit = 1;
+            return;
+        case 'r': // Reset 0 0
+        case 's': // Reset 0 1
+        case 't': // Reset 1 0
+        case 'u': // Reset 1 1
+            state->trst = INT_TO_HDL((cmd - 'r') & 0b10);
+            state->srst = INT_TO_HDL((cmd - 'r') & 0b01);
+            if (HDL_1 == state->trst)
+            {
+                inst->tap = TAP_RESET;
+                inst->dtm.ir = DTM_IR_IDCODE;
+            }
+            break;
+        default:
+            if (cmd >= '0' && cmd <= '7')
+            {
+                char last_tck = state->tck;
+                apply_write(state, cmd);
+                if (HDL_1 == state->tck && HDL_1 != last_tck)
+                {
+                    dtm_clock(inst, HDL_TO_INT(state->tms), HDL_TO_INT(state->tdi));
+                }
+            }
+            break;
+        }
+    }
+}
+
+// Paired mode: consume a read request that directly follows the last edge. It
+// gets answered on the next tick, that is when tdo could first have changed.
+static int defer_read(instance_t *inst)
+{
+    ring_t *rx = &inst->rx_ring;
+    if (!inst->scan.active && ring_count(rx) && 'R' == ring_peek(rx, 0))
+    {
+        ring_drop(rx, 1);
+        stats_command(inst, 'R', 1);
+        inst->pending_read = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Paired mode: take the next edge already in this tick. Only writes that do not
+// depend on tdo qualify and only if they are already buffered.
+static int pair_edge(instance_t *inst, state_t *state)
+{
+    ring_t *rx = &inst->rx_ring;
+    if (inst->scan.active)
+    {
+        if (0 != inst->scan.phase)
+        {
+            return 0; // next step samples tdo
+        }
+        step_scan(inst, HDL_X, state);
+        return 1;
+    }
+
+    if (0 == ring_count(rx))
+    {
+        return 0;
+    }
+    char cmd = ring_peek(rx, 0);
+    if (cmd < '0' || cmd > '7')
+    {
+        return 0;
+    }
+    ring_drop(rx, 1);
+    stats_command(inst, cmd, 1);
+    apply_write(state, cmd);
+    return 1;
+}
+
+// I/O stage, the only place where the command decoder meets the transport.
+// Carries out what the decoder asked for: Hand replies to the remote once
+// enough piled up, close on a quit and refill the receive ring if it ran dry.
+// Returns 1 if the decoder may go on.
+static int exchange_socket(instance_t *inst)
+{
+    int more = 0;
+    if (ring_count(&inst->tx_ring) >= TX_FLUSH_THRESHOLD)
+    {
+        flush_socket(inst);
+        more = 1;
+    }
+    if (inst->quit)
+    {
+        inst->quit = 0;
+        inst->rx_need = 0;
+        flush_socket(inst);
+        if (config.stats)
+        {
+            stats_print(inst);
+        }
+        if (!config.thread && NULL == inst->shm && NULL == inst->replay && !inst->restored)
+        {
+            close_connection(inst); // else wait for the remote to go away
+        }
+        return 0;
+    }
+    if (inst->rx_need)
+    {
+        inst->rx_need = 0;
+        inst->dry++;
+        more = (0 != refill_socket(inst));
+    }
+    return more;
+}
+
+// Decode until a command wrote the outputs or nothing is left to decode.
+static int serve_socket(instance_t *inst, char tdo, state_t *state)
+{
+    for (;;)
+    {
+        int wrote = process_socket(inst, tdo, state);
+        int dry = inst->rx_need;
+        if (!exchange_socket(inst) || !dry)
+        {
+            return wrote;
+        }
+    }
+}
+
+// Accept any incoming connections from OpenOCD (if any). Returns 1 if there is
+// a remote connected.
+static int check_connection(instance_t *inst)
+{
+    if (NULL != inst->replay)
+    {
+        if (!replay_running(inst))
+        {
+            inst->skip_hint = config.accept_poll;
+            return 0;
+        }
+        return 1;
+    }
+    if (inst->restored)
+    {
+        if (restored_pending(inst))
+        {
+            return 1; // as if the remote was still there
+        }
+        end_restored(inst);
+    }
+    if ((NULL != inst->shm) || config.thread)
+    {
+        if (NULL != inst->shm)
+        {
+            sync_shm(inst);
+        }
+        else
+        {
+            sync_link(inst);
+        }
+        if (!inst->linked)
+        {
+            inst->skip_hint = config.accept_poll;
+        }
+        return inst->linked;
+    }
+
+    if (inst->data_socket == -1)
+    {
+        accept_connection(inst);
+        if (inst->data_socket == -1)
+        {
+            inst->skip_hint = config.accept_poll;
+        }
+    }
+    return inst->data_socket != -1;
+}
+
+static unsigned int ready_announced = 0;
+
+// Ready file as OpenOCD Tcl, to be sourced before the adapter configuration:
+// "openocd -f cosim_jtag.ready.tcl -f openocd.cfg". Sets the arrays
+// cosim_jtag_host and cosim_jtag_port per instance id, ready for the
+// remote_bitbang_host and remote_bitbang_port commands.
+static void write_ready_tcl(FILE *file)
+{
+    fprintf(file, "# cosim_jtag: endpoints of simulation %d\n", (int)getpid());
+    fprintf(file, "set cosim_jtag_pid %d\n", (int)getpid());
+    for (int i = 0; i < MAX_INSTANCES; ++i)
+    {
+        instance_t *inst = instances[i];
+        if (NULL == inst)
+        {
+            continue;
+        }
+        if (NULL != inst->shm || NULL != inst->replay)
+        {
+            fprintf(file, "# %d %s is not a socket\n", i, inst->socket_name);
+        }
+        else if (inst->socket_is_tcp)
+        {
+            const char *port = strrchr(inst->socket_name, ':');
+            fprintf(file, "set cosim_jtag_host(%d) {%.*s}\n", i, (int)(port - inst->socket_name),
+                    inst->socket_name);
+            fprintf(file, "set cosim_jtag_port(%d) %s\n", i, port + 1);
+        }
+        else
+        {
+            // With port 0, remote_bitbang_host is the path of a UNIX socket.
+            fprintf(file, "set cosim_jtag_host(%d) {%s}\n", i, inst->socket_name);
+            fprintf(file, "set cosim_jtag_port(%d) 0\n", i);
+        }
+    }
+}
+
+// Let scripts know that remotes may connect now, instead of having them guess
+// with sleeps. The file lists id and endpoint of every instance per line (or
+// sets them as Tcl variables, see write_ready_tcl()) and appears atomically.
+static void announce_ready(void)
+{
+    ready_announced = 1;
+    if (NULL != config.ready)
+    {
+        char tmp[PATH_MAX];
+        format_name(tmp, sizeof(tmp), "%s.tmp", config.ready);
+        FILE *file = fopen(tmp, "w");
+        if (NULL == file)
+        {
+            FAIL("cosim_jtag: failed to create %s: %s (%d)\n", tmp, strerror(errno), errno);
+        }
+        size_t len = strlen(config.ready);
+        if (len >= 4 && 0 == strcmp(config.ready + len - 4, ".tcl"))
+        {
+            write_ready_tcl(file);
+        }
+        else
+        {
+            for (int i = 0; i < MAX_INSTANCES; ++i)
+            {
+                if (NULL != instances[i])
+                {
+                    fprintf(file, "%d %s\n", i, instances[i]->socket_name);
+                }
+            }
+        }
+        if (0 != fclose(file) || -1 == rename(tmp, config.ready))
+        {
+            FAIL("cosim_jtag: failed to create %s: %s (%d)\n", config.ready, strerror(errno), errno);
+        }
+    }
+    PRINT("cosim_jtag: ready for remotes\n");
+}
 
-    unlink(SOCKET_NAME);
+// Block until a remote is connected, sleeping in the kernel meanwhile.
+static int wait_connection(instance_t *inst)
+{
+    PRINT("cosim_jtag: waiting for a remote to connect to %s\n", inst->socket_name);
+    for (;;)
+    {
+        if (NULL != telemetry)
+        {
+            publish_telemetry(inst, 0);
+        }
+        if (NULL != inst->shm)
+        {
+            struct timespec ts = {0, WAIT_TIMEOUT * 1000000L};
+            syscall(SYS_futex, &inst->shm->state, FUTEX_WAIT, COSIM_JTAG_SHM_FREE, &ts, NULL, 0);
+        }
+        else if (config.thread)
+        {
+            futex_wait(&inst->link, LINK_NONE, WAIT_TIMEOUT * 1000000L);
+        }
+        else
+        {
+            poll_sockets(WAIT_TIMEOUT);
+            accept_polled = 0; // check right away
+        }
+        if (check_connection(inst))
+        {
+            inst->skip_hint = 0;
+            return 1;
+        }
+    }
+}
 
-    listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (listen_socket == -1)
+static int update_connection(instance_t *inst)
+{
+    ticks_since_poll++;
+    inst->tick++;
+    // All instances were created during the first round of ticks.
+    if (!ready_announced && inst->tick > 1)
     {
-        FAIL("cosim_jtag: create_socket failed to make socket: %s (%d)\n", strerror(errno), errno);
+        announce_ready();
     }
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(struct sockaddr_un));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_NAME, sizeof(addr.sun_path) - 1);
-    ret = bind(listen_socket, (const struct sockaddr *)&addr,
-               sizeof(struct sockaddr_un));
-    if (ret == -1)
+    int connected = check_connection(inst);
+    if (!connected && NULL == inst->replay && inst->tick > 1 &&
+        (WAIT_ALWAYS == config.wait || (WAIT_FIRST == config.wait && !inst->had_remote)))
     {
-        FAIL("cosim_jtag: create_socket failed to bind socket: %s (%d)\n", strerror(errno), errno);
+        connected = wait_connection(inst);
     }
+    inst->had_remote |= connected;
+    if (NULL != telemetry && 1 == inst->tick % COSIM_JTAG_TELEMETRY_TICKS)
+    {
+        publish_telemetry(inst, connected);
+    }
+    return connected;
+}
 
-    // The processing on the socket is called from within GHDL and cannot run
-    // concurrently, we must not block.
-    fcntl(listen_socket, F_SETFL, O_NONBLOCK);
+// Outputs of one tick, see cosim_jtag_tick() for their meaning. Each
+// simulator interface hands them to VHDL in its own way. Copying them out at
+// the end is a dozen stores to the L1 cache. Storing straight through the
+// caller's pointers from within tick() measured slower, any char pointer may
+// alias the instance state, which then has to be reloaded after every store.
+typedef struct
+{
+    char pins[8]; // tck, tms, tdi, trst, srst, tck2, tms2, tdi2
+    int edges;
+    int skip;
+    int changed;
+    int repeat;
+    int scan_len;
+} tick_out_t;
 
-    ret = listen(listen_socket, 0);
-    if (ret == -1)
+// The actual tick, independent of how the simulator passes arguments. Second
+// edges and the shift engine are only used if the interface is extended.
+static void tick(int id, char tdo, int extended, const char *scan_tdo, char *scan_tms, char *scan_tdi,
+                 tick_out_t *out)
+{
+    instance_t *inst = get_instance(id);
+    if (config.stats)
     {
-        FAIL("cosim_jtag: create_socket failed to listen on socket: %s (%d)\n", strerror(errno), errno);
+        stats_begin(inst);
     }
+    int connected = update_connection(inst);
 
-    PRINT("cosim_jtag: created unix socket at: " SOCKET_NAME "\n");
-}
+    // Answer deferred read request from the last tick.
+    if (inst->pending_read)
+    {
+        inst->pending_read = 0;
+        reply_read(inst, tdo);
+    }
+    if (inst->vscan.len)
+    {
+        finish_vscan(inst, scan_tdo);
+    }
+    if (connected)
+    {
+        exchange_socket(inst); // the above may have piled up replies
+    }
 
-static void accept_connection(void)
-{
-    data_socket = accept(listen_socket, NULL, NULL);
-    if (data_socket == -1)
+    // Hand scans over to VHDL if possible. The outputs then stay as they are
+    // until VHDL starts shifting.
+    state_t *state = &inst->state;
+    out->scan_len = 0;
+    if (connected && config.shift && extended)
     {
-        if (errno != EAGAIN)
+        out->scan_len = start_vscan(inst, state, scan_tms, scan_tdi);
+        if (out->scan_len)
         {
-            FAIL("cosim_jtag: accept_connection failed with: %s (%d)\n", strerror(errno), errno);
+            store_pins(state, out->pins);
+            out->edges = 1;
+            out->skip = 0;
+            out->changed = 0;
+            out->repeat = 0;
+            inst->skip_hint = 0;
+            inst->driven = *state;
+            if (config.stats)
+            {
+                stats_end(inst);
+            }
+            return;
         }
     }
-    else
+
+    // Process data from socket, in paired mode possibly up to a second edge.
+    int wrote = connected && serve_socket(inst, tdo, state);
+    state_t first = *state;
+    out->edges = 1;
+    if (wrote && config.paired && extended)
+    {
+        if (!defer_read(inst) && pair_edge(inst, state))
+        {
+            out->edges = 2;
+            defer_read(inst);
+        }
+    }
+
+    // Always "drive" the output signals.
+    store_pins(&first, out->pins);
+    out->pins[5] = state->tck;
+    out->pins[6] = state->tms;
+    out->pins[7] = state->tdi;
+    out->skip = inst->skip_hint;
+    inst->skip_hint = 0;
+
+    // Most ticks only toggle tck, let VHDL know so it can skip the others.
+    out->changed = changed_mask(&first, &inst->driven);
+    if (2 == out->edges)
+    {
+        out->changed |= changed_mask(state, &first) << CHANGED_SECOND_SHIFT;
+    }
+
+    tap_clock(inst, &first);
+    if (2 == out->edges)
+    {
+        tap_clock(inst, state);
+    }
+    out->repeat = wrote ? collapse_clocks(inst, state) : 0;
+    inst->driven = *state;
+    if (config.stats)
     {
-        PRINT("cosim_jtag: remote connected\n");
+        stats_end(inst);
     }
 }
 
-// Possible states of an VHDL STD_ULOGIC enumeration.
-enum HDL_LOGIC_STATES
+// Interface to VHDL. This is our cyclic "tick" entrypoint. Simulators bind to
+// this function and call it on each rising edge of the simulated clock. See
+// VHDL side of the interface in file "cosim_jtag.vhd" together with simulator
+// specific "cosim_jtag_<simulator_interface>.vhd" package file. The id selects
+// the instance, i.e. socket and state. If edges is set to 2, VHDL drives tck2,
+// tms2 and tdi2 one tick later without calling in. VHDL may skip up to skip
+// clks before calling the next tick, as there is nothing to do for us in the
+// meantime. Only outputs flagged in changed need to be assigned to signals,
+// the others still hold their last driven value. After all that, VHDL toggles
+// tck another repeat times, again one tick later each. With the shift engine,
+// scan_len bits of scan_tms and scan_tdi are shifted out by VHDL instead, the
+// sampled tdo is passed back in scan_tdo on the next tick.
+void cosim_jtag_tick(int id, char tdo, char *tck, char *tms, char *tdi, char *trst, char *srst,
+                     char *tck2, char *tms2, char *tdi2, int *edges, int *skip, int *changed,
+                     int *repeat, const char *scan_tdo, int *scan_len, char *scan_tms, char *scan_tdi)
 {
-    HDL_U = 0, // Uninitialized
-    HDL_X = 1, // Forcing Unknown
-    HDL_0 = 2, // Forcing 0
-    HDL_1 = 3, // Forcing 1
-    HDL_Z = 4, // High Impedance
-    HDL_W = 5, // Weak Unknown
-    HDL_L = 6, // Weak 0
-    HDL_H = 7, // Weak 1
-    HDL_D = 8  // Don't care
-};
-#define HDL_TO_INT(hdl) ((hdl) == HDL_1 || (hdl) == HDL_H)
-#define INT_TO_HDL(i) (((i) != 0) ? HDL_1 : HDL_0)
+    tick_out_t out;
+    tick(id, tdo, 1, scan_tdo, scan_tms, scan_tdi, &out);
+    *tck = out.pins[0];
+    *tms = out.pins[1];
+    *tdi = out.pins[2];
+    *trst = out.pins[3];
+    *srst = out.pins[4];
+    *tck2 = out.pins[5];
+    *tms2 = out.pins[6];
+    *tdi2 = out.pins[7];
+    *edges = out.edges;
+    *skip = out.skip;
+    *changed = out.changed;
+    *repeat = out.repeat;
+    *scan_len = out.scan_len;
+}
 
-typedef struct
+// Interface to VHDL entity "cosim_jtag_packed". Same as cosim_jtag_tick() but
+// with all of tck, tms, tdi, trst and srst in pins, in that order. VHDL assigns
+// them at once whenever any of them changed. There are no second edges and no
+// shift engine, COSIM_JTAG_PAIRED and COSIM_JTAG_SHIFT are ignored.
+void cosim_jtag_tick_packed(int id, char tdo, char *pins, int *skip, int *repeat)
 {
-    // tdo is received from VHDL on every tick, not required to keep state
-    char tck;
-    char tms;
-    char tdi;
-    char trst;
-    char srst;
-} state_t;
-
-// Current/last state of tck, tms, tdi, trst and srst.
-static state_t state = {HDL_X, HDL_X, HDL_X, HDL_0, HDL_0};
+    tick_out_t out;
+    tick(id, tdo, 0, NULL, NULL, NULL, &out);
+    memcpy(pins, out.pins, 5);
+    *skip = out.skip;
+    *repeat = out.repeat;
+}
 
-static void drive_from_state(state_t *state, char *tck, char *tms, char *tdi, char *trst, char *srst)
+// Interface to SystemVerilog module "cosim_jtag_dpi" through DPI-C, e.g. for
+// Verilator. Same as cosim_jtag_tick_packed() but in two-valued logic: tdo is
+// an svBit and pins holds tck, tms, tdi, trst and srst in bits 0 to 4.
+void cosim_jtag_dpi_tick(int id, unsigned char tdo, int *pins, int *skip, int *repeat)
 {
-    *tck = state->tck;
-    *tms = state->tms;
-    *tdi = state->tdi;
-    *trst = state->trst;
-    *srst = state->srst;
+    tick_out_t out;
+    tick(id, INT_TO_HDL(tdo), 0, NULL, NULL, NULL, &out);
+    int word = 0;
+    for (int i = 0; i < 5; ++i)
+    {
+        word |= HDL_TO_INT(out.pins[i]) << i;
+    }
+    *pins = word;
+    *skip = out.skip;
+    *repeat = out.repeat;
 }
 
-static void process_socket(char tdo, state_t *state)
+// Interface to VHDL entity "cosim_dmi". Instead of driving a TAP, the RISC-V
+// DTM is emulated and only the resulting DMI accesses are handed to VHDL. If
+// req_valid is set, VHDL carries out the access with req_op (1: read, 2: write)
+// on req_addr with req_data. It calls in again only once the debug module
+// responded, with rsp_valid set and the read data in rsp_data. Instances of
+// cosim_jtag and cosim_dmi share the range of ids.
+void cosim_dmi_tick(int id, char rsp_valid, int rsp_data, char *req_valid, int *req_op, int *req_addr,
+                    int *req_data, char *srst, int *skip)
 {
-    int ret;
-    char buffer, val;
+    instance_t *inst = get_instance(id);
+    dtm_t *dtm = &inst->dtm;
+    if (config.stats)
+    {
+        stats_begin(inst);
+    }
+    int connected = update_connection(inst);
 
-    // receive data from openocd through socket
-    ret = read(data_socket, &buffer, 1);
-    if (ret == -1)
+    if (HDL_TO_INT(rsp_valid) && 2 == dtm->request)
     {
-        FAIL("cosim_jtag: process_socket failed to read: %s (%d)\n", strerror(errno), errno);
+        dtm->addr = dtm->req_addr;
+        dtm->data = (uint32_t)rsp_data;
+        dtm->status = 0;
+        dtm->request = 0;
+    }
+    else if (2 == dtm->request)
+    {
+        dtm->status = DMI_STATUS_FAILED; // should not happen, VHDL lost it
+        dtm->request = 0;
     }
 
-    if (ret == 0)
+    if (connected)
+    {
+        do
+        {
+            process_dmi(inst);
+        } while (exchange_socket(inst));
+    }
+
+    *req_valid = HDL_0;
+    if (1 == dtm->request)
+    {
+        *req_valid = HDL_1;
+        *req_op = dtm->req_op;
+        *req_addr = dtm->req_addr;
+        *req_data = (int)dtm->req_data;
+        dtm->request = 2;
+    }
+    *srst = inst->state.srst;
+    *skip = inst->skip_hint;
+    inst->skip_hint = 0;
+    if (config.stats)
     {
-        return; // no data to process
+        stats_end(inst);
     }
+}
 
-    // process received byte, protocol according to openocd docs:
-    // https://github.com/openocd-org/openocd/blob/master/doc/manual/jtag/drivers/remote_bitbang.txt
-    switch (buffer)
+// Current TAP state of instance id as tracked from the driven tck and tms, see
+// enum TAP_STATES. Meant for debugging, e.g. from a testbench.
+int cosim_jtag_tap_state(int id)
+{
+    if (id < 0 || id >= MAX_INSTANCES || NULL == instances[id])
     {
-    case 'B': // Blink on
-    case 'b': // Blink off
-        break;
-    case 'R': // Read request
-        val = HDL_TO_INT(tdo) ? '1' : '0';
-        ret = write(data_socket, &val, 1);
-        if (ret == -1)
+        return TAP_RESET;
+    }
+    return instances[id]->tap;
+}
+
+#ifdef USE_FLI
+
+// Checkpoints of ModelSim and QuestaSim ("checkpoint" and "restore" commands)
+// only contain the design. Everything the C side knows about the design is
+// saved alongside as blocks: a header and one snapshot per instance. The
+// connection to the remote is not part of it, a remote still connected when a
+// checkpoint is restored has to connect again. But the commands it had sent
+// up to the checkpoint are, the restored design plays them out to the end.
+// It never sees half a scan, even if VHDL was shifting one at the checkpoint.
+#define CHECKPOINT_MAGIC 0x43544a43 // "CJTC"
+#define CHECKPOINT_VERSION 2
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // of snapshot_t
+    uint32_t count;
+} checkpoint_t;
+
+typedef struct
+{
+    int id;
+    unsigned int had_remote;
+    state_t state;
+    state_t driven;
+    unsigned int tap;
+    char tap_tck;
+    dtm_t dtm; // a DMI access may be in flight in VHDL
+    // Command decoder, see restored_pending().
+    unsigned int pending_read;
+    ring_t rx_ring; // commands not yet processed
+    scan_t scan;    // packed scan being played out
+    vscan_t vscan;  // bits being shifted out by VHDL
+} snapshot_t;
+
+// Warm restore: The remote talked to a design that is gone now, kick it out.
+static void drop_connection(instance_t *inst)
+{
+    if (NULL != inst->shm)
+    {
+        unsigned int attached = COSIM_JTAG_SHM_ATTACHED;
+        __atomic_compare_exchange_n(&inst->shm->state, &attached, COSIM_JTAG_SHM_DETACHED, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        sync_shm(inst);
+    }
+    else if (config.thread)
+    {
+        // The I/O thread owns the socket. It sees end of file and lets go.
+        if (LINK_UP == __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE))
         {
-            FAIL("cosim_jtag: process_socket failed to write: %s (%d)\n", strerror(errno), errno);
+            shutdown(inst->data_socket, SHUT_RDWR);
         }
-        break;
-    case 'Q': // Quit request
-        PRINT("cosim_jtag: remote disconnected\n");
-        close(data_socket);
-        data_socket = -1;
-        break;
-    case '0': // Write 0 0 0
-    case '1': // Write 0 0 1
-    case '2': // Write 0 1 0
-    case '3': // Write 0 1 1
-    case '4': // Write 1 0 0
-    case '5': // Write 1 0 1
-    case '6': // Write 1 1 0
-    case '7': // Write 1 1 1
-        val = buffer - '0';
-        state->tck = INT_TO_HDL(val & 0b100);
-        state->tms = INT_TO_HDL(val & 0b010);
-        state->tdi = INT_TO_HDL(val & 0b001);
-        break;
-    case 'r': // Reset 0 0
-    case 's': // Reset 0 1
-    case 't': // Reset 1 0
-    case 'u': // Reset 1 1
-        val = buffer - 'r';
-        state->trst = INT_TO_HDL(val & 0b10);
-        state->srst = INT_TO_HDL(val & 0b01);
-    default:
-        break;
+        while (LINK_UP == __atomic_load_n(&inst->link, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+        sync_link(inst);
+    }
+    else if (inst->data_socket != -1)
+    {
+        close_connection(inst);
     }
+    reset_connection(inst);
 }
 
-// Interface to VHDL. This is our cyclic "tick" entrypoint. Simulators bind to
-// this function and call it on each rising edge of the simulated clock. See
-// VHDL side of the interface in file "cosim_jtag.vhd" together with simulator
-// specific "cosim_jtag_<simulator_interface>.vhd" package file.
-void cosim_jtag_tick(char tdo, char *tck, char *tms, char *tdi, char *trst, char *srst)
+static void save_fli(void *param)
 {
-    // Create and open a named file socked if not already open.
-    if (listen_socket == -1)
+    (void)param;
+    checkpoint_t header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, sizeof(snapshot_t), instance_count};
+    mti_SaveBlock((char *)&header, sizeof(header));
+    // Too large for the stack of the simulator.
+    static snapshot_t snapshot;
+    for (int i = 0; i < MAX_INSTANCES; ++i)
     {
-        create_socket();
+        instance_t *inst = instances[i];
+        if (NULL != inst)
+        {
+            snapshot.id = inst->id;
+            snapshot.had_remote = inst->had_remote;
+            snapshot.state = inst->state;
+            snapshot.driven = inst->driven;
+            snapshot.tap = inst->tap;
+            snapshot.tap_tck = inst->tap_tck;
+            snapshot.dtm = inst->dtm;
+            snapshot.pending_read = inst->pending_read;
+            // The I/O thread may still fill the ring, take what is there now.
+            snapshot.rx_ring.tail = inst->rx_ring.tail;
+            snapshot.rx_ring.head = ring_count(&inst->rx_ring) + inst->rx_ring.tail;
+            memcpy(snapshot.rx_ring.data, inst->rx_ring.data, RING_SIZE);
+            snapshot.scan = inst->scan;
+            snapshot.vscan = inst->vscan;
+            mti_SaveBlock((char *)&snapshot, sizeof(snapshot));
+        }
     }
+}
 
-    // Accept any incoming connections from OpenOCD (if any).
-    if (data_socket == -1)
+// Either a warm restore with all instances still around, or a cold restore
+// into a freshly loaded library with none of them created yet.
+static void restore_fli(void *param)
+{
+    (void)param;
+    checkpoint_t header;
+    mti_RestoreBlock((char *)&header);
+    if (CHECKPOINT_MAGIC != header.magic || CHECKPOINT_VERSION != header.version ||
+        sizeof(snapshot_t) != header.size)
     {
-        accept_connection();
+        FAIL("cosim_jtag: checkpoint was saved by an incompatible version\n");
     }
-
-    // Process data from socket.
-    if (data_socket != -1)
+    static snapshot_t snapshot;
+    for (uint32_t i = 0; i < header.count; ++i)
     {
-        process_socket(tdo, &state);
+        mti_RestoreBlock((char *)&snapshot);
+        instance_t *inst = get_instance(snapshot.id);
+        drop_connection(inst);
+        inst->had_remote = snapshot.had_remote;
+        inst->state = snapshot.state;
+        inst->driven = snapshot.driven;
+        inst->tap = snapshot.tap;
+        inst->tap_tck = snapshot.tap_tck;
+        inst->dtm = snapshot.dtm;
+        // The I/O thread owns the receive ring, there the commands are lost.
+        if (!config.thread && NULL == inst->replay)
+        {
+            inst->pending_read = snapshot.pending_read;
+            inst->rx_ring = snapshot.rx_ring;
+            inst->scan = snapshot.scan;
+            inst->vscan = snapshot.vscan;
+            inst->record_rx = inst->rx_ring.head; // recorded before
+            inst->restored = restored_pending(inst);
+        }
     }
+    PRINT("cosim_jtag: restored %u instance(s) from checkpoint\n", header.count);
+}
 
-    // Always "drive" the output signals.
-    drive_from_state(&state, tck, tms, tdi, trst, srst);
+// Initialization function of a foreign module, load it with
+// vsim -foreign "cosim_jtag_fli_init ./cosim_jtag.so". Foreign subprograms have
+// no such entry point of their own. Both callbacks have to be registered
+// before the simulation starts, on a restore vsim calls this again first. In
+// a warm restore, the callbacks are still registered.
+void cosim_jtag_fli_init(mtiRegionIdT region, char *param, mtiInterfaceListT *generics,
+                         mtiInterfaceListT *ports)
+{
+    (void)region;
+    (void)param;
+    (void)generics;
+    (void)ports;
+    static int registered = 0;
+    if (!registered)
+    {
+        mti_AddSaveCB(save_fli, NULL);
+        mti_AddRestoreCB(restore_fli, NULL);
+        registered = 1;
+    }
 }
 
+#endif // USE_FLI
+
 #ifdef USE_VHPI
 
 typedef struct param_handle_map_s
@@ -240,14 +3556,39 @@ typedef struct param_handle_map_s
 } param_handle_map_t;
 
 static param_handle_map_t param_handle_map[] = {
+    {"id", vhpiConstParamDeclK, NULL},
     {"tdo", vhpiConstParamDeclK, NULL},
     {"tck", vhpiVarParamDeclK, NULL},
     {"tms", vhpiVarParamDeclK, NULL},
     {"tdi", vhpiVarParamDeclK, NULL},
     {"trst", vhpiVarParamDeclK, NULL},
     {"srst", vhpiVarParamDeclK, NULL},
+    {"tck2", vhpiVarParamDeclK, NULL},
+    {"tms2", vhpiVarParamDeclK, NULL},
+    {"tdi2", vhpiVarParamDeclK, NULL},
+    {"edges", vhpiVarParamDeclK, NULL},
+    {"skip", vhpiVarParamDeclK, NULL},
+    {"changed", vhpiVarParamDeclK, NULL},
+    {"repeat", vhpiVarParamDeclK, NULL},
+    {"scan_tdo", vhpiConstParamDeclK, NULL},
+    {"scan_len", vhpiVarParamDeclK, NULL},
+    {"scan_tms", vhpiVarParamDeclK, NULL},
+    {"scan_tdi", vhpiVarParamDeclK, NULL},
     {NULL, 0, NULL}};
 
+// Indices into above map.
+#define VHPI_ID 0
+#define VHPI_TDO 1
+#define VHPI_PINS 2 // first of the eight STD_ULOGIC outputs
+#define VHPI_EDGES 10
+#define VHPI_SKIP 11
+#define VHPI_CHANGED 12
+#define VHPI_REPEAT 13
+#define VHPI_SCAN_TDO 14
+#define VHPI_SCAN_LEN 15
+#define VHPI_SCAN_TMS 16
+#define VHPI_SCAN_TDI 17
+
 static int check_vhpi_handles(const param_handle_map_t *handle_map)
 {
     for (int i = 0; NULL != handle_map[i].name; ++i)
@@ -292,58 +3633,240 @@ static void lookup_vhpi_handles(vhpiHandleT proc_decl_h, param_handle_map_t *han
     }
 }
 
-#define VHPI_LOGIC_TO_ENUM(l) (((l) == vhpi1 || (l) == vhpiH) ? HDL_1 : HDL_0)
-#define ENUM_TO_VHPI_LOGIC(e) (((e) == HDL_1) ? vhpi1 : vhpi0)
+// VHPI encodes STD_ULOGIC in the same order as enum HDL_LOGIC_STATES, values
+// are passed through as they are.
+_Static_assert(vhpiU == HDL_U && vhpiX == HDL_X && vhpi0 == HDL_0 && vhpi1 == HDL_1 && vhpiH == HDL_H,
+               "VHPI logic encoding differs from HDL_LOGIC_STATES");
+
+// Value descriptors, prepared once on resolving the handles. Per tick only the
+// actual values need to be filled in.
+static vhpiValueT id_value;
+static vhpiValueT tdo_value;
+static vhpiValueT pin_values[8];
+static vhpiValueT int_values[5]; // edges, skip, changed, repeat, scan_len
+static vhpiValueT vec_value;
+static vhpiEnumT vec_buffer[VSCAN_BITS];
+static int vhpi_resolved = 0;
+
+static void resolve_vhpi(const vhpiCbDataT *cb_data)
+{
+    if (vhpiProcDeclK != vhpi_get(vhpiKindP, cb_data->obj))
+    {
+        FAIL("cosim_jtag: callback expected VHPI object of kind 'vhpiProcDeclK' aka 'PROCEDURE'\n");
+    }
+
+    lookup_vhpi_handles(cb_data->obj, param_handle_map);
+    if (check_vhpi_handles(param_handle_map))
+    {
+        FAIL("cosim_jtag: could not resolve VHPI handles of procedure arguments\n");
+    }
+
+    memset(&id_value, 0, sizeof(id_value));
+    id_value.format = vhpiIntVal;
+    memset(&tdo_value, 0, sizeof(tdo_value));
+    tdo_value.format = vhpiLogicVal;
+    for (int i = 0; i < 8; ++i)
+    {
+        memset(&pin_values[i], 0, sizeof(pin_values[i]));
+        pin_values[i].format = vhpiLogicVal;
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        memset(&int_values[i], 0, sizeof(int_values[i]));
+        int_values[i].format = vhpiIntVal;
+    }
+    memset(&vec_value, 0, sizeof(vec_value));
+    vec_value.format = vhpiLogicVecVal;
+    vec_value.bufSize = sizeof(vec_buffer);
+    vec_value.numElems = VSCAN_BITS;
+    vec_value.value.enumvs = vec_buffer;
+    vhpi_resolved = 1;
+}
+
+static void get_vhpi_input(const param_handle_map_t *handle_map, int *id, char *tdo)
+{
+    vhpi_get_value(handle_map[VHPI_ID].handle, &id_value);
+    *id = id_value.value.intg;
+    vhpi_get_value(handle_map[VHPI_TDO].handle, &tdo_value);
+    *tdo = tdo_value.value.enumv;
+}
+
+// Only changed outputs get deposited, VHDL ignores the others. Every deposit
+// schedules an event in the simulation kernel, these are the expensive ones.
+static void set_vhpi_outputs(const param_handle_map_t *handle_map, const tick_out_t *out)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        if (out->changed & (1 << i))
+        {
+            pin_values[i].value.enumv = out->pins[i];
+            vhpi_put_value(handle_map[VHPI_PINS + i].handle, &pin_values[i], vhpiDepositPropagate);
+        }
+    }
+    int_values[0].value.intg = out->edges;
+    vhpi_put_value(handle_map[VHPI_EDGES].handle, &int_values[0], vhpiDepositPropagate);
+    int_values[1].value.intg = out->skip;
+    vhpi_put_value(handle_map[VHPI_SKIP].handle, &int_values[1], vhpiDepositPropagate);
+    int_values[2].value.intg = out->changed;
+    vhpi_put_value(handle_map[VHPI_CHANGED].handle, &int_values[2], vhpiDepositPropagate);
+    int_values[3].value.intg = out->repeat;
+    vhpi_put_value(handle_map[VHPI_REPEAT].handle, &int_values[3], vhpiDepositPropagate);
+    int_values[4].value.intg = out->scan_len;
+    vhpi_put_value(handle_map[VHPI_SCAN_LEN].handle, &int_values[4], vhpiDepositPropagate);
+}
 
-static void get_vhpi_input(const param_handle_map_t *handle_map, char *tdo)
+// Vectors are only exchanged if there is a scan, see shift engine.
+static void get_vhpi_vector(vhpiHandleT handle, char *vec)
 {
-    vhpiValueT tdo_v;
-    tdo_v.format = vhpiLogicVal;
-    int ret = vhpi_get_value(handle_map[0].handle, &tdo_v);
-    *tdo = VHPI_LOGIC_TO_ENUM(tdo_v.value.enumv);
+    vhpi_get_value(handle, &vec_value);
+    for (int i = 0; i < VSCAN_BITS; ++i)
+    {
+        vec[i] = vec_buffer[i];
+    }
 }
 
-static void set_vhpi_outputs(const param_handle_map_t *handle_map, char tck, char tms, char tdi, char trst, char srst)
+static void set_vhpi_vector(vhpiHandleT handle, const char *vec, int len)
 {
-    vhpiValueT value;
-    value.format = vhpiLogicVal;
-    value.value.enumv = ENUM_TO_VHPI_LOGIC(tck);
-    vhpi_put_value(handle_map[1].handle, &value, vhpiDepositPropagate);
-    value.value.enumv = ENUM_TO_VHPI_LOGIC(tms);
-    vhpi_put_value(handle_map[2].handle, &value, vhpiDepositPropagate);
-    value.value.enumv = ENUM_TO_VHPI_LOGIC(tdi);
-    vhpi_put_value(handle_map[3].handle, &value, vhpiDepositPropagate);
-    value.value.enumv = ENUM_TO_VHPI_LOGIC(trst);
-    vhpi_put_value(handle_map[4].handle, &value, vhpiDepositPropagate);
-    value.value.enumv = ENUM_TO_VHPI_LOGIC(srst);
-    vhpi_put_value(handle_map[5].handle, &value, vhpiDepositPropagate);
+    for (int i = 0; i < VSCAN_BITS; ++i)
+    {
+        vec_buffer[i] = (i < len) ? vec[i] : vhpi0;
+    }
+    vhpi_put_value(handle, &vec_value, vhpiDepositPropagate);
 }
 
 static void exec_vhpi(const vhpiCbDataT *cb_data)
 {
-    if (vhpiProcDeclK != vhpi_get(vhpiKindP, cb_data->obj))
+    // Kind and parameter handles of the procedure never change, check once.
+    if (!vhpi_resolved)
     {
-        FAIL("cosim_jtag: callback expected VHPI object of kind 'vhpiProcDeclK' aka 'PROCEDURE'\n");
+        resolve_vhpi(cb_data);
     }
 
-    if (check_vhpi_handles(param_handle_map))
+    char tdo;
+    int id;
+    tick_out_t out;
+    static char scan_tdo[VSCAN_BITS], scan_tms[VSCAN_BITS], scan_tdi[VSCAN_BITS];
+    get_vhpi_input(param_handle_map, &id, &tdo);
+    if (id >= 0 && id < MAX_INSTANCES && NULL != instances[id] && instances[id]->vscan.len)
+    {
+        get_vhpi_vector(param_handle_map[VHPI_SCAN_TDO].handle, scan_tdo);
+    }
+    // Straight to the tick, no detour over the generic pointer interface.
+    tick(id, tdo, 1, scan_tdo, scan_tms, scan_tdi, &out);
+    set_vhpi_outputs(param_handle_map, &out);
+    if (out.scan_len)
+    {
+        set_vhpi_vector(param_handle_map[VHPI_SCAN_TMS].handle, scan_tms, out.scan_len);
+        set_vhpi_vector(param_handle_map[VHPI_SCAN_TDI].handle, scan_tdi, out.scan_len);
+    }
+}
+
+static param_handle_map_t dmi_param_handle_map[] = {
+    {"id", vhpiConstParamDeclK, NULL},
+    {"rsp_valid", vhpiConstParamDeclK, NULL},
+    {"rsp_data", vhpiConstParamDeclK, NULL},
+    {"req_valid", vhpiVarParamDeclK, NULL},
+    {"req_op", vhpiVarParamDeclK, NULL},
+    {"req_addr", vhpiVarParamDeclK, NULL},
+    {"req_data", vhpiVarParamDeclK, NULL},
+    {"srst", vhpiVarParamDeclK, NULL},
+    {"skip", vhpiVarParamDeclK, NULL},
+    {NULL, 0, NULL}};
+static int dmi_vhpi_resolved = 0;
+
+// DMI accesses are rare compared to ticks, values are set up on each call.
+static void exec_dmi_vhpi(const vhpiCbDataT *cb_data)
+{
+    param_handle_map_t *map = dmi_param_handle_map;
+    if (!dmi_vhpi_resolved)
     {
-        lookup_vhpi_handles(cb_data->obj, param_handle_map);
-        if (check_vhpi_handles(param_handle_map))
+        lookup_vhpi_handles(cb_data->obj, map);
+        if (check_vhpi_handles(map))
         {
             FAIL("cosim_jtag: could not resolve VHPI handles of procedure arguments\n");
         }
+        dmi_vhpi_resolved = 1;
     }
 
-    char tdo, tck, tms, tdi, trst, srst;
-    get_vhpi_input(param_handle_map, &tdo);
-    cosim_jtag_tick(tdo, &tck, &tms, &tdi, &trst, &srst);
-    set_vhpi_outputs(param_handle_map, tck, tms, tdi, trst, srst);
+    vhpiValueT logic = {.format = vhpiLogicVal};
+    vhpiValueT intg = {.format = vhpiIntVal};
+    vhpi_get_value(map[0].handle, &intg);
+    int id = intg.value.intg;
+    vhpi_get_value(map[1].handle, &logic);
+    char rsp_valid = logic.value.enumv;
+    vhpi_get_value(map[2].handle, &intg);
+    int rsp_data = intg.value.intg;
+
+    char req_valid, srst;
+    int req_op = 0, req_addr = 0, req_data = 0, skip;
+    cosim_dmi_tick(id, rsp_valid, rsp_data, &req_valid, &req_op, &req_addr, &req_data, &srst, &skip);
+
+    logic.value.enumv = req_valid;
+    vhpi_put_value(map[3].handle, &logic, vhpiDepositPropagate);
+    int outputs[] = {req_op, req_addr, req_data};
+    for (int i = 0; i < 3; ++i)
+    {
+        intg.value.intg = outputs[i];
+        vhpi_put_value(map[4 + i].handle, &intg, vhpiDepositPropagate);
+    }
+    logic.value.enumv = srst;
+    vhpi_put_value(map[7].handle, &logic, vhpiDepositPropagate);
+    intg.value.intg = skip;
+    vhpi_put_value(map[8].handle, &intg, vhpiDepositPropagate);
 }
 
-static void end_vhpi(const vhpiCbDataT *cb_data)
+static param_handle_map_t packed_param_handle_map[] = {
+    {"id", vhpiConstParamDeclK, NULL},
+    {"tdo", vhpiConstParamDeclK, NULL},
+    {"pins", vhpiVarParamDeclK, NULL},
+    {"skip", vhpiVarParamDeclK, NULL},
+    {"repeat", vhpiVarParamDeclK, NULL},
+    {NULL, 0, NULL}};
+static vhpiValueT packed_pins_value;
+static vhpiEnumT packed_pins_buffer[5];
+static int packed_vhpi_resolved = 0;
+
+static void exec_packed_vhpi(const vhpiCbDataT *cb_data)
+{
+    param_handle_map_t *map = packed_param_handle_map;
+    if (!packed_vhpi_resolved)
+    {
+        lookup_vhpi_handles(cb_data->obj, map);
+        if (check_vhpi_handles(map))
+        {
+            FAIL("cosim_jtag: could not resolve VHPI handles of procedure arguments\n");
+        }
+        memset(&packed_pins_value, 0, sizeof(packed_pins_value));
+        packed_pins_value.format = vhpiLogicVecVal;
+        packed_pins_value.bufSize = sizeof(packed_pins_buffer);
+        packed_pins_value.numElems = 5;
+        packed_pins_value.value.enumvs = packed_pins_buffer;
+        packed_vhpi_resolved = 1;
+    }
+
+    vhpiValueT logic = {.format = vhpiLogicVal};
+    vhpiValueT intg = {.format = vhpiIntVal};
+    vhpi_get_value(map[0].handle, &intg);
+    int id = intg.value.intg;
+    vhpi_get_value(map[1].handle, &logic);
+    char tdo = logic.value.enumv;
+
+    tick_out_t out;
+    tick(id, tdo, 0, NULL, NULL, NULL, &out);
+
+    for (int i = 0; i < 5; ++i)
+    {
+        packed_pins_buffer[i] = out.pins[i];
+    }
+    vhpi_put_value(map[2].handle, &packed_pins_value, vhpiDepositPropagate);
+    intg.value.intg = out.skip;
+    vhpi_put_value(map[3].handle, &intg, vhpiDepositPropagate);
+    intg.value.intg = out.repeat;
+    vhpi_put_value(map[4].handle, &intg, vhpiDepositPropagate);
+}
+
+static void release_vhpi_handles(param_handle_map_t *param_handle)
 {
-    param_handle_map_t *param_handle = (param_handle_map_t *)cb_data->user_data;
     for (int i = 0; NULL != param_handle[i].name; ++i)
     {
         if (NULL != param_handle[i].handle)
@@ -354,6 +3877,21 @@ static void end_vhpi(const vhpiCbDataT *cb_data)
     }
 }
 
+static void end_vhpi(const vhpiCbDataT *cb_data)
+{
+    (void)cb_data;
+    if (config.stats)
+    {
+        stats_print_all();
+    }
+    release_vhpi_handles(param_handle_map);
+    release_vhpi_handles(dmi_param_handle_map);
+    release_vhpi_handles(packed_param_handle_map);
+    vhpi_resolved = 0;
+    dmi_vhpi_resolved = 0;
+    packed_vhpi_resolved = 0;
+}
+
 static void register_vhpi(const vhpiCbDataT *cb_data)
 {
     vhpiForeignDataT foreign_data = {
@@ -369,6 +3907,32 @@ static void register_vhpi(const vhpiCbDataT *cb_data)
     }
     vhpi_release_handle(cb_h);
 
+    vhpiForeignDataT dmi_foreign_data = {
+        vhpiProcF,
+        "cosim_jtag.so",       // must precisely match VHDL "foreign" attribute
+        "cosim_dmi_vhpi_exec", // must precisely match VHDL "foreign" attribute
+        NULL,
+        exec_dmi_vhpi};
+    cb_h = vhpi_register_foreignf(&dmi_foreign_data);
+    if (!cb_h)
+    {
+        FAIL("cosim_jtag: failed to register VHPI foreign function");
+    }
+    vhpi_release_handle(cb_h);
+
+    vhpiForeignDataT packed_foreign_data = {
+        vhpiProcF,
+        "cosim_jtag.so",               // must precisely match VHDL "foreign" attribute
+        "cosim_jtag_packed_vhpi_exec", // must precisely match VHDL "foreign" attribute
+        NULL,
+        exec_packed_vhpi};
+    cb_h = vhpi_register_foreignf(&packed_foreign_data);
+    if (!cb_h)
+    {
+        FAIL("cosim_jtag: failed to register VHPI foreign function");
+    }
+    vhpi_release_handle(cb_h);
+
     vhpiCbDataT end_cb = {
         .cb_rtn = end_vhpi,
         .reason = vhpiCbEndOfSimulation,
@@ -16,14 +16,33 @@
 --                          if the driven logic is capable of processing
 --                          changing tck, tms, and tdi signals on each clk.
 --
--- Note #2:                 Only a single instance of this entity may ever be in
---                          a design (for now).
+-- Note #2:                 Multiple instances of this entity may be in a
+--                          design, each must be given an unique ID generic.
+--                          Every instance gets its own socket, see README.
+--
+-- Note #3:                 The C side may return two edges of tck in a single
+--                          call to tick (env COSIM_JTAG_PAIRED=1). The second
+--                          edge is then driven DELAY + 1 clks later without
+--                          calling into C again.
+--
+-- Note #4:                 While there is nothing to do for JTAG (no remote
+--                          connected or idle), the C side lets the entity skip
+--                          calls to tick for a number of clks.
+--
+-- Note #5:                 Runs of plain tck toggles with constant tms and tdi
+--                          (e.g. clocking in Run-Test/Idle) are played out by
+--                          the entity itself, one toggle every DELAY + 1 clks.
+--
+-- Note #6:                 With env COSIM_JTAG_SHIFT=1 the C side hands whole
+--                          scans over as vectors. The entity shifts them out
+--                          on its own at the same rate and returns tdo with the
+--                          next call to tick.
 --
 -- Author:                  Niklaus Leuenberger <@NikLeberg>
 --
 -- SPDX-License-Identifier: MIT
 --
--- Version:                 0.4
+-- Version:                 0.11
 --
 -- Changes:                 0.1, 2024-08-09, NikLeberg
 --                              initial version
@@ -33,6 +52,20 @@
 --                              simplify counter logic
 --                          0.4, 2024-09-18, NikLeberg
 --                              integrate fli interface, rename to cosim_jtag
+--                          0.5, 2026-10-14, NikLeberg
+--                              drive optional second edge returned by tick
+--                          0.6, 2026-10-14, NikLeberg
+--                              skip clks as requested by tick
+--                          0.7, 2026-10-14, NikLeberg
+--                              only assign outputs that changed
+--                          0.8, 2026-10-14, NikLeberg
+--                              support multiple instances with ID generic
+--                          0.9, 2026-10-14, NikLeberg
+--                              play out runs of tck toggles requested by tick
+--                          0.10, 2026-10-14, NikLeberg
+--                              shift out scan vectors returned by tick
+--                          0.11, 2026-10-14, NikLeberg
+--                              toggle the last driven tck, not v_tck
 -- =============================================================================
 
 LIBRARY ieee;
@@ -44,7 +77,8 @@ USE cosim.cosim_jtag_pkg.ALL;
 
 ENTITY cosim_jtag IS
     GENERIC (
-        DELAY : NATURAL := 3 -- delay in counts of clk, 0 is no delay
+        DELAY : NATURAL := 3; -- delay in counts of clk, 0 is no delay
+        ID    : NATURAL := 0  -- unique id of instance, selects the socket
     );
     PORT (
         clk           : IN STD_ULOGIC; -- system clock
@@ -67,15 +101,91 @@ BEGIN
     -- Call into C-function and exchange current JTAG signal values.
     jtag_tick : PROCESS (clk)
         VARIABLE v_tck, v_tms, v_tdi, v_trst, v_srst : STD_ULOGIC;
+        VARIABLE v_tck2, v_tms2, v_tdi2 : STD_ULOGIC;
+        -- Last value assigned to tck. Unchanged outputs of tick are not
+        -- written back by every interface (VHPI), v_tck may be stale.
+        VARIABLE v_tck_driven : STD_ULOGIC := 'U';
+        VARIABLE v_edges : INTEGER := 1;
+        VARIABLE v_skip : NATURAL := 0;
+        VARIABLE v_changed_int : NATURAL;
+        VARIABLE v_changed : UNSIGNED(7 DOWNTO 0);
+        VARIABLE v_repeat : NATURAL := 0;
+        VARIABLE v_scan_len, v_scan_pos : NATURAL := 0;
+        VARIABLE v_scan_rise : BOOLEAN := FALSE;
+        VARIABLE v_scan_tms, v_scan_tdi, v_scan_tdo : scan_vector_t;
     BEGIN
         IF rising_edge(clk) THEN
-            IF delay_count = 0 THEN
-                tick(tdo, v_tck, v_tms, v_tdi, v_trst, v_srst);
-                tck <= v_tck;
-                tms <= v_tms;
-                tdi <= v_tdi;
-                trst <= v_trst;
-                srst <= v_srst;
+            IF v_skip > 0 THEN
+                v_skip := v_skip - 1;
+            ELSIF delay_count = 0 THEN
+                IF v_edges = 2 THEN
+                    -- Second edge of last call, C is not interested in tdo.
+                    IF v_changed(5) = '1' THEN
+                        tck <= v_tck2;
+                        v_tck_driven := v_tck2;
+                    END IF;
+                    IF v_changed(6) = '1' THEN
+                        tms <= v_tms2;
+                    END IF;
+                    IF v_changed(7) = '1' THEN
+                        tdi <= v_tdi2;
+                    END IF;
+                    v_edges := 1;
+                ELSIF v_repeat > 0 THEN
+                    -- Clocking with constant tms and tdi, C already accounted
+                    -- for these edges.
+                    v_tck_driven := NOT v_tck_driven;
+                    tck <= v_tck_driven;
+                    v_repeat := v_repeat - 1;
+                ELSIF v_scan_pos < v_scan_len THEN
+                    -- Shift engine, same timing as C would do per edge.
+                    IF v_scan_rise THEN
+                        -- tdo is valid since the falling edge
+                        v_scan_tdo(v_scan_pos) := tdo;
+                        tck <= '1';
+                        v_tck_driven := '1';
+                        v_scan_pos := v_scan_pos + 1;
+                        v_scan_rise := FALSE;
+                    ELSE
+                        tck <= '0';
+                        v_tck_driven := '0';
+                        tms <= v_scan_tms(v_scan_pos);
+                        tdi <= v_scan_tdi(v_scan_pos);
+                        v_scan_rise := TRUE;
+                    END IF;
+                ELSE
+                    tick(ID, tdo, v_tck, v_tms, v_tdi, v_trst, v_srst,
+                    v_tck2, v_tms2, v_tdi2, v_edges, v_skip, v_changed_int,
+                    v_repeat, v_scan_tdo, v_scan_len, v_scan_tms, v_scan_tdi);
+                    IF v_scan_len > 0 THEN
+                        -- Start shifting right away with the first bit.
+                        tck <= '0';
+                        v_tck_driven := '0';
+                        tms <= v_scan_tms(0);
+                        tdi <= v_scan_tdi(0);
+                        v_scan_pos := 0;
+                        v_scan_rise := TRUE;
+                    END IF;
+                    -- Unchanged outputs still hold their last value, don't
+                    -- bother the simulator with new transactions for them.
+                    v_changed := to_unsigned(v_changed_int, 8);
+                    IF v_changed(0) = '1' THEN
+                        tck <= v_tck;
+                        v_tck_driven := v_tck;
+                    END IF;
+                    IF v_changed(1) = '1' THEN
+                        tms <= v_tms;
+                    END IF;
+                    IF v_changed(2) = '1' THEN
+                        tdi <= v_tdi;
+                    END IF;
+                    IF v_changed(3) = '1' THEN
+                        trst <= v_trst;
+                    END IF;
+                    IF v_changed(4) = '1' THEN
+                        srst <= v_srst;
+                    END IF;
+                END IF;
             END IF;
         END IF;
     END PROCESS jtag_tick;
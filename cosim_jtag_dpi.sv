@@ -0,0 +1,83 @@
+// =============================================================================
+// File:                    cosim_jtag_dpi.sv
+//
+// Module:                  cosim_jtag_dpi
+//
+// Description:             SystemVerilog counterpart of the VHDL entity
+//                          cosim_jtag_packed. Calls into the same C side
+//                          through DPI-C, e.g. with Verilator. All outputs are
+//                          returned packed into one int.
+//
+// Note #1:                 Use the DELAY parameter to slow down tck in respect
+//                          to clk, see VHDL entity cosim_jtag.
+//
+// Note #2:                 No second edges and no shift engine, the C side
+//                          ignores env COSIM_JTAG_PAIRED and COSIM_JTAG_SHIFT.
+//                          Skipping of idle clks and playing out runs of tck
+//                          toggles are supported.
+//
+// Note #3:                 Instances share the range of ID parameters with
+//                          all VHDL entities, see README.
+//
+// Author:                  Niklaus Leuenberger <@NikLeberg>
+//
+// SPDX-License-Identifier: MIT
+//
+// Version:                 0.1
+//
+// Changes:                 0.1, 2026-10-14, NikLeberg
+//                              initial version
+// =============================================================================
+
+module cosim_jtag_dpi #(
+    parameter int DELAY = 3, // delay in counts of clk, 0 is no delay
+    parameter int ID    = 0  // unique id of instance, selects the socket
+) (
+    input  logic clk, // system clock
+    input  logic tdo,
+    output logic tck,
+    output logic tms,
+    output logic tdi,
+    output logic trst, // JTAG TAP reset, active-high
+    output logic srst  // system reset, active-high
+);
+
+    // Exchange values with C, pins holds tck, tms, tdi, trst and srst in bits
+    // 0 to 4.
+    import "DPI-C" function void cosim_jtag_dpi_tick(
+        input int id,
+        input bit tdo,
+        output int pins,
+        output int skip, // clks until next tick
+        output int repeat_count // tck toggles to play out
+    );
+
+    int pins = 0;
+    int skip = 0;
+    int repeat_count = 0;
+    int delay_count = 0;
+
+    // Call into C-function with the same timing as the VHDL entity.
+    always @(posedge clk) begin
+        if (skip > 0) begin
+            skip = skip - 1;
+        end else if (delay_count == 0) begin
+            if (repeat_count > 0) begin
+                // Clocking with constant tms and tdi, C already accounted for
+                // these edges.
+                pins = pins ^ 1;
+                repeat_count = repeat_count - 1;
+            end else begin
+                cosim_jtag_dpi_tick(ID, tdo, pins, skip, repeat_count);
+            end
+        end
+        delay_count = (delay_count >= DELAY) ? 0 : delay_count + 1;
+    end
+
+    assign tck  = pins[0];
+    assign tms  = pins[1];
+    assign tdi  = pins[2];
+    assign trst = pins[3];
+    assign srst = pins[4];
+
+endmodule
@@ -15,33 +15,127 @@
 --
 -- SPDX-License-Identifier: MIT
 --
--- Version:                 0.1
+-- Version:                 0.9
 --
 -- Changes:                 0.1, 2024-09-17, NikLeberg
 --                              initial version
+--                          0.2, 2026-10-14, NikLeberg
+--                              optional second edge of tck per tick
+--                          0.3, 2026-10-14, NikLeberg
+--                              number of clks to skip until next tick
+--                          0.4, 2026-10-14, NikLeberg
+--                              mask of outputs that changed since last tick
+--                          0.5, 2026-10-14, NikLeberg
+--                              id of the calling instance
+--                          0.6, 2026-10-14, NikLeberg
+--                              number of tck toggles to play out after tick
+--                          0.7, 2026-10-14, NikLeberg
+--                              scan vectors for the VHDL shift engine
+--                          0.8, 2026-10-14, NikLeberg
+--                              dmi_tick for entity cosim_dmi
+--                          0.9, 2026-10-14, NikLeberg
+--                              tick_packed for entity cosim_jtag_packed
 -- =============================================================================
 
 LIBRARY ieee;
 USE ieee.std_logic_1164.ALL;
 
 PACKAGE cosim_jtag_pkg IS
+    -- Scans shifted out by the entity itself, see env COSIM_JTAG_SHIFT.
+    CONSTANT SCAN_VECTOR_BITS : NATURAL := 256; -- must match VSCAN_BITS in C
+    SUBTYPE scan_vector_t IS STD_ULOGIC_VECTOR(0 TO SCAN_VECTOR_BITS - 1);
+
+    -- All outputs at once, see entity cosim_jtag_packed.
+    SUBTYPE pins_t IS STD_ULOGIC_VECTOR(0 TO 4); -- tck, tms, tdi, trst, srst
+
     -- Exchange values between VHDL and C.
     PROCEDURE tick (
+        id                        : IN INTEGER;    -- instance of connector
         tdo                       : IN STD_ULOGIC; -- current value of tdo
-        tck, tms, tdi, trst, srst : OUT STD_ULOGIC
+        tck, tms, tdi, trst, srst : OUT STD_ULOGIC;
+        tck2, tms2, tdi2          : OUT STD_ULOGIC; -- optional second edge
+        edges                     : OUT INTEGER;    -- 1 or 2 edges returned
+        skip                      : OUT NATURAL;    -- clks until next tick
+        changed                   : OUT NATURAL;    -- mask of changed outputs
+        repeat                    : OUT NATURAL;    -- tck toggles to play out
+        scan_tdo                  : IN scan_vector_t;  -- tdo sampled in last scan
+        scan_len                  : OUT NATURAL;       -- bits to shift, 0 if none
+        scan_tms, scan_tdi        : OUT scan_vector_t
     );
     -- ModelSim/QuestaSim specific way of declaring foreign MTI FLI C-function:
     --  -> "<c_function> <shared_library>"
     ATTRIBUTE foreign OF tick : PROCEDURE IS "cosim_jtag_tick ./cosim_jtag.so";
+
+    -- Exchange DMI accesses between VHDL and C, see entity cosim_dmi.
+    PROCEDURE dmi_tick (
+        id        : IN INTEGER;    -- instance of connector
+        rsp_valid : IN STD_ULOGIC; -- response to last request is in rsp_data
+        rsp_data  : IN INTEGER;
+        req_valid : OUT STD_ULOGIC; -- DMI access to carry out
+        req_op    : OUT NATURAL;    -- 1: read, 2: write
+        req_addr  : OUT NATURAL;
+        req_data  : OUT INTEGER;
+        srst      : OUT STD_ULOGIC;
+        skip      : OUT NATURAL -- clks until next dmi_tick
+    );
+    ATTRIBUTE foreign OF dmi_tick : PROCEDURE IS "cosim_dmi_tick ./cosim_jtag.so";
+
+    -- Exchange values between VHDL and C with packed outputs and without
+    -- second edges or scan vectors.
+    PROCEDURE tick_packed (
+        id     : IN INTEGER;    -- instance of connector
+        tdo    : IN STD_ULOGIC; -- current value of tdo
+        pins   : OUT pins_t;
+        skip   : OUT NATURAL; -- clks until next tick
+        repeat : OUT NATURAL  -- tck toggles to play out
+    );
+    ATTRIBUTE foreign OF tick_packed : PROCEDURE IS "cosim_jtag_tick_packed ./cosim_jtag.so";
 END PACKAGE;
 
 PACKAGE BODY cosim_jtag_pkg IS
     PROCEDURE tick (
+        id                        : IN INTEGER;    -- instance of connector
         tdo                       : IN STD_ULOGIC; -- current value of tdo
-        tck, tms, tdi, trst, srst : OUT STD_ULOGIC
+        tck, tms, tdi, trst, srst : OUT STD_ULOGIC;
+        tck2, tms2, tdi2          : OUT STD_ULOGIC; -- optional second edge
+        edges                     : OUT INTEGER;    -- 1 or 2 edges returned
+        skip                      : OUT NATURAL;    -- clks until next tick
+        changed                   : OUT NATURAL;    -- mask of changed outputs
+        repeat                    : OUT NATURAL;    -- tck toggles to play out
+        scan_tdo                  : IN scan_vector_t;  -- tdo sampled in last scan
+        scan_len                  : OUT NATURAL;       -- bits to shift, 0 if none
+        scan_tms, scan_tdi        : OUT scan_vector_t
     ) IS
     BEGIN
         -- dummy implementation, gets overwritten by C function cosim_jtag_tick
         REPORT "ERROR: foreign subprogram cosim_jtag_tick not called" SEVERITY failure;
     END;
+
+    PROCEDURE dmi_tick (
+        id        : IN INTEGER;    -- instance of connector
+        rsp_valid : IN STD_ULOGIC; -- response to last request is in rsp_data
+        rsp_data  : IN INTEGER;
+        req_valid : OUT STD_ULOGIC; -- DMI access to carry out
+        req_op    : OUT NATURAL;    -- 1: read, 2: write
+        req_addr  : OUT NATURAL;
+        req_data  : OUT INTEGER;
+        srst      : OUT STD_ULOGIC;
+        skip      : OUT NATURAL -- clks until next dmi_tick
+    ) IS
+    BEGIN
+        -- dummy implementation, gets overwritten by C function cosim_dmi_tick
+        REPORT "ERROR: foreign subprogram cosim_dmi_tick not called" SEVERITY failure;
+    END;
+
+    PROCEDURE tick_packed (
+        id     : IN INTEGER;    -- instance of connector
+        tdo    : IN STD_ULOGIC; -- current value of tdo
+        pins   : OUT pins_t;
+        skip   : OUT NATURAL; -- clks until next tick
+        repeat : OUT NATURAL  -- tck toggles to play out
+    ) IS
+    BEGIN
+        -- dummy implementation, gets overwritten by C function cosim_jtag_tick_packed
+        REPORT "ERROR: foreign subprogram cosim_jtag_tick_packed not called" SEVERITY failure;
+    END;
 END PACKAGE BODY;
@@ -0,0 +1,90 @@
+-- =============================================================================
+-- File:                    cosim_jtag_packed.vhdl
+--
+-- Entity:                  cosim_jtag_packed
+--
+-- Description:             Variant of cosim_jtag with all outputs packed into
+--                          one vector. C hands them over in a single argument
+--                          and they are updated with a single assignment,
+--                          either all or none at all. Fewer arguments to pass
+--                          and fewer signals for the simulator to update.
+--
+-- Note #1:                 Same as cosim_jtag, use the DELAY generic to slow
+--                          down tck in respect to clk.
+--
+-- Note #2:                 No second edges and no shift engine, the C side
+--                          ignores env COSIM_JTAG_PAIRED and COSIM_JTAG_SHIFT.
+--                          Skipping of idle clks and playing out runs of tck
+--                          toggles are supported.
+--
+-- Note #3:                 Instances of cosim_jtag_packed, cosim_jtag and
+--                          cosim_dmi share the same range of ID generics.
+--
+-- Author:                  Niklaus Leuenberger <@NikLeberg>
+--
+-- SPDX-License-Identifier: MIT
+--
+-- Version:                 0.2
+--
+-- Changes:                 0.1, 2026-10-14, NikLeberg
+--                              initial version
+--                          0.2, 2026-10-14, NikLeberg
+--                              explicit initial value of v_driven
+-- =============================================================================
+
+LIBRARY ieee;
+USE ieee.std_logic_1164.ALL;
+
+LIBRARY cosim;
+USE cosim.cosim_jtag_pkg.ALL;
+
+ENTITY cosim_jtag_packed IS
+    GENERIC (
+        DELAY : NATURAL := 3; -- delay in counts of clk, 0 is no delay
+        ID    : NATURAL := 0  -- unique id of instance, selects the socket
+    );
+    PORT (
+        clk  : IN STD_ULOGIC; -- system clock
+        tdo  : IN STD_ULOGIC;
+        pins : OUT pins_t -- tck, tms, tdi, trst and srst (both active-high)
+    );
+END ENTITY;
+
+ARCHITECTURE sim OF cosim_jtag_packed IS
+    SIGNAL delay_count, delay_count_next : NATURAL RANGE 0 TO DELAY := 0;
+BEGIN
+
+    -- Delay calls to tick procedure to slow down tck in respect to clk.
+    delay_count_next <= 0 WHEN delay_count >= DELAY ELSE
+        delay_count + 1;
+    delay_count <= delay_count_next WHEN rising_edge(clk);
+
+    -- Call into C-function and exchange current JTAG signal values.
+    jtag_tick : PROCESS (clk)
+        VARIABLE v_pins : pins_t;
+        -- Never returned by C, so the first tick drives all pins.
+        VARIABLE v_driven : pins_t := (OTHERS => 'U');
+        VARIABLE v_skip : NATURAL := 0;
+        VARIABLE v_repeat : NATURAL := 0;
+    BEGIN
+        IF rising_edge(clk) THEN
+            IF v_skip > 0 THEN
+                v_skip := v_skip - 1;
+            ELSIF delay_count = 0 THEN
+                IF v_repeat > 0 THEN
+                    -- Clocking with constant tms and tdi, C already accounted
+                    -- for these edges.
+                    v_pins(0) := NOT v_pins(0);
+                    v_repeat := v_repeat - 1;
+                ELSE
+                    tick_packed(ID, tdo, v_pins, v_skip, v_repeat);
+                END IF;
+                IF v_pins /= v_driven THEN
+                    pins <= v_pins;
+                    v_driven := v_pins;
+                END IF;
+            END IF;
+        END IF;
+    END PROCESS jtag_tick;
+
+END ARCHITECTURE;
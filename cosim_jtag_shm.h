@@ -0,0 +1,199 @@
+/**
+ * @file cosim_jtag_shm.h
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief Shared memory transport of cosim_jtag. Layout of the shared memory
+ *        and helpers for the remote side, i.e. an OpenOCD driver or a bridge.
+ * @version 0.3
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version
+ * 0.2      2026-10-14  NikLeberg  wake a simulation waiting for a remote
+ * 0.3      2026-10-14  NikLeberg  process id of the simulation
+ *
+ * Protocol:
+ * With COSIM_JTAG_SOCKET=shm:/<name> the simulation creates the POSIX shared
+ * memory object /<name> (see shm_open) holding a cosim_jtag_shm_t. It carries
+ * the very same byte stream as the remote_bitbang socket would, including the
+ * extended 'X' and 'x' scans. There is one ring per direction, each with
+ * exactly one producer and one consumer:
+ *  - to_sim:    commands, written by the remote, read by the simulation
+ *  - to_remote: replies, written by the simulation, read by the remote
+ *
+ * Head and tail are free running byte counters, head - tail is the number of
+ * bytes in the ring. The producer writes the data and then publishes head with
+ * release semantics, the consumer reads head with acquire semantics and
+ * publishes tail after it is done with the data. The consumer of a ring may
+ * sleep on its head with FUTEX_WAIT (not private, the mapping is shared by two
+ * processes) after setting waiting to 1. After publishing head, the producer
+ * issues FUTEX_WAKE if waiting is 1. Both sides must bound their sleep with a
+ * timeout, the flag handshake is not meant to be airtight.
+ *
+ * Only one remote may be attached at a time. state is COSIM_JTAG_SHM_FREE
+ * while the simulation waits for a remote. A remote attaches by swapping it
+ * atomically to COSIM_JTAG_SHM_ATTACHED, followed by FUTEX_WAKE on state as
+ * the simulation may sleep on it (see COSIM_JTAG_WAIT). It detaches by setting
+ * it to COSIM_JTAG_SHM_DETACHED. The simulation then empties both rings and
+ * sets state back to COSIM_JTAG_SHM_FREE. Sending 'Q' before detaching is
+ * polite but not required.
+ */
+
+#ifndef COSIM_JTAG_SHM_H
+#define COSIM_JTAG_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define COSIM_JTAG_SHM_MAGIC 0x47544a43 // "CJTG"
+#define COSIM_JTAG_SHM_VERSION 2
+#define COSIM_JTAG_SHM_RING_SIZE 4096 // power of two
+
+#define COSIM_JTAG_SHM_FREE 0
+#define COSIM_JTAG_SHM_ATTACHED 1
+#define COSIM_JTAG_SHM_DETACHED 2
+
+// Producer and consumer indices live on their own cache lines.
+typedef struct
+{
+    uint32_t head __attribute__((aligned(64))); // written by producer
+    uint32_t tail __attribute__((aligned(64))); // written by consumer
+    uint32_t waiting;                           // consumer sleeps on head
+    char data[COSIM_JTAG_SHM_RING_SIZE] __attribute__((aligned(64)));
+} cosim_jtag_shm_ring_t;
+
+typedef struct
+{
+    uint32_t magic;   // COSIM_JTAG_SHM_MAGIC once initialized
+    uint32_t version; // COSIM_JTAG_SHM_VERSION
+    uint32_t state;   // COSIM_JTAG_SHM_FREE, _ATTACHED or _DETACHED
+    uint32_t pid;     // of the simulation, which never replaces a live one
+    cosim_jtag_shm_ring_t to_sim;
+    cosim_jtag_shm_ring_t to_remote;
+} cosim_jtag_shm_t;
+
+static inline uint32_t cosim_jtag_shm_count(const cosim_jtag_shm_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline void cosim_jtag_shm_wait(cosim_jtag_shm_ring_t *ring, uint32_t head, long timeout_ns)
+{
+    struct timespec ts = {0, timeout_ns};
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (head == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    {
+        syscall(SYS_futex, &ring->head, FUTEX_WAIT, head, &ts, NULL, 0);
+    }
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+}
+
+static inline void cosim_jtag_shm_wake(cosim_jtag_shm_ring_t *ring)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED))
+    {
+        syscall(SYS_futex, &ring->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+// Producer: Put up to len bytes into the ring. Returns the number of bytes
+// actually written, less if the ring is full.
+static inline uint32_t cosim_jtag_shm_write(cosim_jtag_shm_ring_t *ring, const void *buf, uint32_t len)
+{
+    uint32_t space = COSIM_JTAG_SHM_RING_SIZE - cosim_jtag_shm_count(ring);
+    uint32_t head = ring->head;
+    if (len > space)
+    {
+        len = space;
+    }
+    for (uint32_t done = 0; done < len;)
+    {
+        uint32_t offset = (head + done) & (COSIM_JTAG_SHM_RING_SIZE - 1);
+        uint32_t chunk = COSIM_JTAG_SHM_RING_SIZE - offset;
+        if (chunk > len - done)
+        {
+            chunk = len - done;
+        }
+        memcpy(&ring->data[offset], (const char *)buf + done, chunk);
+        done += chunk;
+    }
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    cosim_jtag_shm_wake(ring);
+    return len;
+}
+
+// Consumer: Take up to len bytes out of the ring. Returns the number of bytes
+// actually read, 0 if the ring is empty.
+static inline uint32_t cosim_jtag_shm_read(cosim_jtag_shm_ring_t *ring, void *buf, uint32_t len)
+{
+    uint32_t count = cosim_jtag_shm_count(ring);
+    uint32_t tail = ring->tail;
+    if (len > count)
+    {
+        len = count;
+    }
+    for (uint32_t done = 0; done < len;)
+    {
+        uint32_t offset = (tail + done) & (COSIM_JTAG_SHM_RING_SIZE - 1);
+        uint32_t chunk = COSIM_JTAG_SHM_RING_SIZE - offset;
+        if (chunk > len - done)
+        {
+            chunk = len - done;
+        }
+        memcpy((char *)buf + done, &ring->data[offset], chunk);
+        done += chunk;
+    }
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+// Remote: Map and attach to the transport of a running simulation. Returns
+// NULL if it does not exist (yet) or another remote is attached.
+static inline cosim_jtag_shm_t *cosim_jtag_shm_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    void *map = mmap(NULL, sizeof(cosim_jtag_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return NULL;
+    }
+
+    cosim_jtag_shm_t *shm = (cosim_jtag_shm_t *)map;
+    uint32_t expected = COSIM_JTAG_SHM_FREE;
+    if (COSIM_JTAG_SHM_MAGIC != __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) ||
+        COSIM_JTAG_SHM_VERSION != shm->version ||
+        !__atomic_compare_exchange_n(&shm->state, &expected, COSIM_JTAG_SHM_ATTACHED, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        munmap(map, sizeof(cosim_jtag_shm_t));
+        return NULL;
+    }
+    syscall(SYS_futex, &shm->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+    return shm;
+}
+
+// Remote: Detach and unmap, the simulation then waits for the next remote.
+static inline void cosim_jtag_shm_detach(cosim_jtag_shm_t *shm)
+{
+    __atomic_store_n(&shm->state, COSIM_JTAG_SHM_DETACHED, __ATOMIC_RELEASE);
+    cosim_jtag_shm_wake(&shm->to_sim);
+    munmap(shm, sizeof(cosim_jtag_shm_t));
+}
+
+#endif // COSIM_JTAG_SHM_H
@@ -0,0 +1,140 @@
+/**
+ * @file cosim_jtag_telemetry.h
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief Live telemetry of cosim_jtag. Layout of the shared memory page and a
+ *        helper for readers, i.e. a dashboard or a monitoring script.
+ * @version 0.2
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version
+ * 0.2      2026-10-14  NikLeberg  bound the retries of readers
+ *
+ * Protocol:
+ * With COSIM_JTAG_TELEMETRY=/<name> the simulation creates the POSIX shared
+ * memory object /<name> (see shm_open) holding a cosim_jtag_telemetry_t. It
+ * has one slot per instance id. The simulation updates the slot of an
+ * instance every COSIM_JTAG_TELEMETRY_TICKS of its ticks and while it waits
+ * for a remote to connect. Readers only ever read, any number of them may map
+ * the page read-only without the simulation noticing.
+ *
+ * Each slot is guarded by a sequence lock: seq is odd while the simulation
+ * updates the slot. A reader copies the slot between two loads of seq and
+ * retries if they differ or are odd, see cosim_jtag_telemetry_read(). A
+ * simulation that is descheduled or killed in the middle of an update leaves
+ * seq odd, readers give up after COSIM_JTAG_TELEMETRY_RETRIES attempts.
+ *
+ * Counters are totals since the start of the simulation, rates refer to the
+ * interval since the previous update. An instance whose time stops advancing
+ * is blocked, usually in a blocking read from a remote that sends nothing.
+ * One that is I/O-starved has a high share of dry ticks and empty queues, one
+ * that is simulator-bound has few dry ticks and commands queued up.
+ */
+
+#ifndef COSIM_JTAG_TELEMETRY_H
+#define COSIM_JTAG_TELEMETRY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define COSIM_JTAG_TELEMETRY_MAGIC 0x4d544a43 // "CJTM"
+#define COSIM_JTAG_TELEMETRY_VERSION 1
+#define COSIM_JTAG_TELEMETRY_SLOTS 16       // one per instance id
+#define COSIM_JTAG_TELEMETRY_TICKS 1024     // ticks between two updates
+#define COSIM_JTAG_TELEMETRY_RETRIES 100000 // loads of seq before a reader gives up
+
+#define COSIM_JTAG_TELEMETRY_UNUSED 0  // no such instance (yet)
+#define COSIM_JTAG_TELEMETRY_WAITING 1 // no remote connected
+#define COSIM_JTAG_TELEMETRY_CONNECTED 2
+
+#define COSIM_JTAG_TELEMETRY_BUSY -1 // of cosim_jtag_telemetry_read()
+
+// Written by the simulation only, each on its own cache line.
+typedef struct
+{
+    uint32_t seq;      // odd while being updated
+    uint32_t state;    // COSIM_JTAG_TELEMETRY_UNUSED, _WAITING or _CONNECTED
+    uint32_t tap;      // TAP state, 0 Test-Logic-Reset to 15 Update-IR in the
+                       // order of IEEE 1149.1 (DR column before IR column)
+    uint32_t rx_queue; // commands received but not yet processed, bytes
+    uint32_t tx_queue; // replies not yet sent, bytes
+    uint32_t reserved;
+    uint64_t time_ns;  // CLOCK_MONOTONIC of the update
+    uint64_t ticks;    // calls into C
+    uint64_t dry;      // times the commands ran out while processing
+    uint64_t cycles;   // rising edges of tck, i.e. shifted bits and idle clocks
+    uint64_t ticks_per_s;
+    uint64_t cycles_per_s;
+} __attribute__((aligned(64))) cosim_jtag_telemetry_slot_t;
+
+typedef struct
+{
+    uint32_t magic;   // COSIM_JTAG_TELEMETRY_MAGIC once initialized
+    uint32_t version; // COSIM_JTAG_TELEMETRY_VERSION
+    uint32_t pid;     // of the simulation
+    cosim_jtag_telemetry_slot_t slots[COSIM_JTAG_TELEMETRY_SLOTS];
+} cosim_jtag_telemetry_t;
+
+// Reader: Map the telemetry of a running simulation. Returns NULL if it does
+// not exist (yet).
+static inline const cosim_jtag_telemetry_t *cosim_jtag_telemetry_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    void *map = mmap(NULL, sizeof(cosim_jtag_telemetry_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return NULL;
+    }
+    const cosim_jtag_telemetry_t *telemetry = (const cosim_jtag_telemetry_t *)map;
+    if (COSIM_JTAG_TELEMETRY_MAGIC != __atomic_load_n(&telemetry->magic, __ATOMIC_ACQUIRE) ||
+        COSIM_JTAG_TELEMETRY_VERSION != telemetry->version)
+    {
+        munmap(map, sizeof(cosim_jtag_telemetry_t));
+        return NULL;
+    }
+    return telemetry;
+}
+
+// Reader: Take a consistent copy of the slot of instance id. Returns 1 on
+// success, 0 if there is no such instance and COSIM_JTAG_TELEMETRY_BUSY if no
+// consistent copy could be taken. Try again later then, if the simulation
+// still runs (see pid).
+static inline int cosim_jtag_telemetry_read(const cosim_jtag_telemetry_t *telemetry, int id,
+                                            cosim_jtag_telemetry_slot_t *slot)
+{
+    const cosim_jtag_telemetry_slot_t *src = &telemetry->slots[id];
+    for (int retries = 0; retries < COSIM_JTAG_TELEMETRY_RETRIES; retries++)
+    {
+        uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        memcpy(slot, (const void *)src, sizeof(*slot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&src->seq, __ATOMIC_RELAXED))
+        {
+            return COSIM_JTAG_TELEMETRY_UNUSED != slot->state;
+        }
+    }
+    return COSIM_JTAG_TELEMETRY_BUSY;
+}
+
+// Reader: Unmap again.
+static inline void cosim_jtag_telemetry_close(const cosim_jtag_telemetry_t *telemetry)
+{
+    munmap((void *)telemetry, sizeof(cosim_jtag_telemetry_t));
+}
+
+#endif // COSIM_JTAG_TELEMETRY_H
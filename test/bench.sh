@@ -0,0 +1,112 @@
+#!/usr/bin/env bash
+
+# This script benchmarks cosim_jtag. It runs a fixed JTAG workload (see
+# bench.tcl) against the NEORV32 testbench for each requested backend and
+# reports bits per second of each step together with the tick statistics of
+# the C side (COSIM_JTAG_STATS=1). Backend "micro" instead runs tick_bench.c,
+# a microbenchmark of the C side alone, in all notable configurations. Each is
+# followed by hotpath_test.c, which fails if the hot path allocates, makes
+# syscalls or prints, and dmi_test.c, which fails if DMI mode gets an access
+# wrong.
+#
+# Usage: ./bench.sh [micro|ghdl|nvc|nvc-direct|fli]...
+#
+# Note: Other than the test_<simulator>.sh scripts, this does not set up any
+# container. Run it where the tools of the respective test script are in PATH,
+# e.g. inside its container, after the test script cloned ./neorv32_src.
+
+set -e
+
+# Run the simulation given as arguments in the background, wait until it
+# listens and run the workload with openocd.
+run_workload() {
+    rm -f cosim_jtag.ready
+    COSIM_JTAG_STATS=1 COSIM_JTAG_WAIT=1 COSIM_JTAG_READY=cosim_jtag.ready "$@" &
+    SIM=$!
+    while [ ! -e cosim_jtag.ready ]; do
+        if ! kill -0 $SIM 2>/dev/null; then
+            echo "bench: simulation exited early" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+    openocd -f openocd.cfg -f bench.tcl 2>&1 | grep "bench:"
+    kill $SIM 2>/dev/null || true
+    wait $SIM 2>/dev/null || true
+}
+
+neorv32_sources() {
+    NEORV32_LOCAL_RTL=./neorv32_src/rtl
+    FILE_LIST=`cat $NEORV32_LOCAL_RTL/file_list_soc.f`
+    echo "${FILE_LIST//NEORV32_RTL_PATH_PLACEHOLDER/"$NEORV32_LOCAL_RTL"}"
+}
+
+bench_micro() {
+    gcc -O2 -pthread -o tick_bench tick_bench.c ../cosim_jtag.c
+    gcc -O2 -pthread -o hotpath_test hotpath_test.c
+    gcc -O2 -pthread -o dmi_test dmi_test.c ../cosim_jtag.c
+    for CONFIG in "" "COSIM_JTAG_PAIRED=1" "COSIM_JTAG_SHIFT=1" \
+        "COSIM_JTAG_THREAD=1" "COSIM_JTAG_NONBLOCK=1"; do
+        echo "bench: micro ${CONFIG:-default}"
+        env $CONFIG ./tick_bench
+        env $CONFIG ./hotpath_test
+        env $CONFIG ./dmi_test
+    done
+}
+
+bench_ghdl() {
+    mkdir -p build
+    ghdl -a --work=neorv32 --workdir=build $(neorv32_sources)
+    ghdl -a --work=cosim --workdir=build ../cosim_jtag_ghdl.vhd ../cosim_jtag.vhd
+    gcc -O2 -shared -fPIC -o cosim_jtag.so ../cosim_jtag.c
+    ghdl -a -Pbuild --workdir=build tb.vhd
+    ghdl -e -Pbuild --workdir=build tb
+    run_workload ./tb --max-stack-alloc=0 --ieee-asserts=disable
+}
+
+bench_nvc() {
+    nvc --work=neorv32 -a $(neorv32_sources)
+    nvc --work=cosim -a ../cosim_jtag_vhpi.vhd ../cosim_jtag.vhd
+    gcc -O2 -shared -fPIC -DUSE_VHPI -o cosim_jtag.so ../cosim_jtag.c
+    nvc -L. -a tb.vhd
+    nvc -L. -e tb
+    run_workload nvc -L. -r --load ./cosim_jtag.so --ieee-warnings=off tb
+}
+
+bench_nvc_direct() {
+    nvc --work=neorv32 -a $(neorv32_sources)
+    nvc --work=cosim -a ../cosim_jtag_ghdl.vhd ../cosim_jtag.vhd
+    gcc -O2 -shared -fPIC -o cosim_jtag.so ../cosim_jtag.c
+    nvc -L. -a tb.vhd
+    nvc -L. -e tb
+    run_workload nvc -L. -r --ieee-warnings=off tb
+}
+
+bench_fli() {
+    vmap -c
+    vlib work
+    vlib neorv32
+    vmap neorv32 work
+    vlib cosim
+    vmap cosim work
+    vcom -work neorv32 -autoorder $(neorv32_sources)
+    vcom -work cosim ../cosim_jtag_fli.vhd ../cosim_jtag.vhd
+    vcom tb.vhd
+    gcc -O2 -shared -fPIC -o cosim_jtag.so ../cosim_jtag.c
+    run_workload vsim -c tb -do "run -all"
+}
+
+cd "$(dirname "$0")"
+for BACKEND in ${@:-micro}; do
+    case $BACKEND in
+    micro) bench_micro ;;
+    ghdl) bench_ghdl ;;
+    nvc) bench_nvc ;;
+    nvc-direct) bench_nvc_direct ;;
+    fli) bench_fli ;;
+    *)
+        echo "bench: unknown backend $BACKEND" >&2
+        exit 1
+        ;;
+    esac
+done
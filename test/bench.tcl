@@ -0,0 +1,41 @@
+# Fixed JTAG workload of bench.sh, use after openocd.cfg. Each step reports its
+# wall time and the rate of payload bits, i.e. without any tms overhead.
+
+init
+halt
+
+proc bench {name bits body} {
+    set start [clock milliseconds]
+    uplevel 1 $body
+    set ms [expr {max(1, [clock milliseconds] - $start)}]
+    echo [format "bench: %-12s %8d ms %12.0f bits/s" $name $ms [expr {$bits * 1000.0 / $ms}]]
+}
+
+# IR scan of 5 and DR scan of 32 bits each.
+set loops 200
+bench idcode [expr {$loops * 37}] {
+    for {set i 0} {$i < $loops} {incr i} {
+        irscan riscv.cpu 0x01
+        drscan riscv.cpu 32 0
+    }
+}
+
+# Read dmstatus, request and response are a 41 bit DMI scan each.
+set loops 200
+bench dmi_read [expr {$loops * 82}] {
+    for {set i 0} {$i < $loops} {incr i} {
+        riscv dmi_read 0x11
+    }
+}
+
+# Bulk write into DMEM of the NEORV32, 32 bits per word.
+set words 1024
+set data {}
+for {set i 0} {$i < $words} {incr i} {
+    lappend data [expr {$i * 0x01010101}]
+}
+bench mem_write [expr {$words * 32}] {
+    write_memory 0x80000000 32 $data
+}
+
+shutdown
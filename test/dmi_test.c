@@ -0,0 +1,409 @@
+/**
+ * @file dmi_test.c
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief Test of DMI mode without any simulator. The main thread plays the
+ *        VHDL entity cosim_dmi together with a mock debug module that is slow
+ *        to accept requests and even slower to respond. A second thread plays
+ *        OpenOCD: it scans IDCODE and dtmcs of the emulated DTM and then
+ *        writes and reads back DMI registers. Fails if any value is wrong, if
+ *        a DMI access is lost or duplicated, or if OpenOCD ever sees a DMI
+ *        status other than success, e.g. busy.
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version
+ *
+ * Usage: dmi_test [accesses]
+ * Compile together with cosim_jtag.c, see bench.sh. All COSIM_JTAG_* settings
+ * apply, except COSIM_JTAG_SOCKET and COSIM_JTAG_DMI_IDCODE which are set by
+ * the test itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mock_tap.h"
+
+void cosim_dmi_tick(int id, char rsp_valid, int rsp_data, char *req_valid, int *req_op, int *req_addr,
+                    int *req_data, char *srst, int *skip);
+
+#define DTM_IR_DTMCS 0x10
+#define DTM_IR_DMI 0x11
+#define DMI_ABITS 7
+#define DMI_LEN (DMI_ABITS + 34)
+#define DMI_OP_NOP 0
+#define DMI_OP_READ 1
+#define DMI_OP_WRITE 2
+#define DMI_REGS (1 << DMI_ABITS)
+
+// Clks the debug module takes to accept a request and to respond to it. The
+// response delay grows with every access, up to RSP_DELAY * 4.
+#define READY_DELAY 3
+#define RSP_DELAY 8
+
+// DMI bus between cosim_dmi and the debug module, as driven on the last clk.
+typedef struct
+{
+    char req_valid;
+    int req_op, req_addr;
+    uint32_t req_data;
+    char req_ready, rsp_valid;
+    uint32_t rsp_data;
+} dmi_bus_t;
+
+enum
+{
+    DM_IDLE,
+    DM_ACCEPT,
+    DM_RESPOND
+};
+
+typedef struct
+{
+    dmi_bus_t bus;
+    // Entity, see cosim_dmi.vhd.
+    char v_rsp_valid, v_req_valid, v_srst;
+    int v_rsp_data, v_req_op, v_req_addr, v_req_data, v_skip, v_pending;
+    // Debug module.
+    int dm_state, dm_wait;
+    uint32_t dm_data;
+    uint32_t regs[DMI_REGS];
+    unsigned long reads, writes;
+} mock_dmi_t;
+
+static void mock_dmi_init(mock_dmi_t *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->bus.req_valid = MOCK_0;
+    m->v_rsp_valid = MOCK_0;
+    m->v_req_valid = MOCK_0;
+    m->v_srst = MOCK_0;
+}
+
+// The process of entity cosim_dmi.
+static void mock_dmi_entity(mock_dmi_t *m, const dmi_bus_t *last)
+{
+    if (m->v_pending)
+    {
+        if (MOCK_1 == m->v_req_valid && last->req_ready)
+        {
+            m->bus.req_valid = MOCK_0;
+            m->v_req_valid = MOCK_0;
+        }
+        if (MOCK_0 == m->v_req_valid && last->rsp_valid)
+        {
+            m->v_rsp_valid = MOCK_1;
+            m->v_rsp_data = (int)last->rsp_data;
+            m->v_pending = 0;
+        }
+    }
+    else if (m->v_skip > 0)
+    {
+        m->v_skip--;
+    }
+    else
+    {
+        cosim_dmi_tick(0, m->v_rsp_valid, m->v_rsp_data, &m->v_req_valid, &m->v_req_op, &m->v_req_addr,
+                       &m->v_req_data, &m->v_srst, &m->v_skip);
+        m->v_rsp_valid = MOCK_0;
+        if (MOCK_1 == m->v_req_valid)
+        {
+            m->bus.req_valid = MOCK_1;
+            m->bus.req_op = m->v_req_op;
+            m->bus.req_addr = m->v_req_addr;
+            m->bus.req_data = (uint32_t)m->v_req_data;
+            m->v_pending = 1;
+        }
+    }
+}
+
+// Debug module with DMI_REGS plain registers on the other side of the bus.
+static void mock_dmi_module(mock_dmi_t *m, const dmi_bus_t *last)
+{
+    m->bus.req_ready = 0;
+    m->bus.rsp_valid = 0;
+    if (m->dm_wait > 0)
+    {
+        m->dm_wait--;
+        return;
+    }
+    switch (m->dm_state)
+    {
+    case DM_IDLE:
+        if (MOCK_1 == last->req_valid)
+        {
+            m->dm_state = DM_ACCEPT;
+            m->dm_wait = READY_DELAY;
+        }
+        break;
+    case DM_ACCEPT:
+        m->bus.req_ready = 1;
+        m->dm_data = 0;
+        if (DMI_OP_READ == last->req_op)
+        {
+            m->dm_data = m->regs[last->req_addr];
+            m->reads++;
+        }
+        else if (DMI_OP_WRITE == last->req_op)
+        {
+            m->regs[last->req_addr] = last->req_data;
+            m->writes++;
+        }
+        else
+        {
+            fprintf(stderr, "dmi_test: debug module got op %d\n", last->req_op);
+            exit(EXIT_FAILURE);
+        }
+        m->dm_state = DM_RESPOND;
+        m->dm_wait = RSP_DELAY * (1 + (m->reads + m->writes) % 4);
+        break;
+    case DM_RESPOND:
+        m->bus.rsp_valid = 1;
+        m->bus.rsp_data = m->dm_data;
+        m->dm_state = DM_IDLE;
+        break;
+    }
+}
+
+// One rising edge of clk. Both processes see what the other drove before.
+static void mock_dmi_clk(mock_dmi_t *m)
+{
+    dmi_bus_t last = m->bus;
+    mock_dmi_entity(m, &last);
+    mock_dmi_module(m, &last);
+}
+
+// OpenOCD side.
+static int client_socket = -1;
+static unsigned int accesses = 1000;
+static volatile int client_done = 0;
+
+static void send_all(const char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = send(client_socket, buf, len, 0);
+        if (ret <= 0)
+        {
+            perror("dmi_test: send");
+            exit(EXIT_FAILURE);
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+static void recv_all(char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = recv(client_socket, buf, len, 0);
+        if (ret <= 0)
+        {
+            perror("dmi_test: recv");
+            exit(EXIT_FAILURE);
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+// Packed scan from Run-Test/Idle through Shift-IR or Shift-DR and back, bits
+// of value are shifted in LSB first. IR scans are sent without a reply.
+static size_t packed_scan(char *p, int ir, uint64_t value, int bits)
+{
+    int tms[DMI_LEN + 6], tdi[DMI_LEN + 6];
+    int n = 0;
+    tms[n] = 1, tdi[n++] = 0; // Select-DR-Scan
+    if (ir)
+    {
+        tms[n] = 1, tdi[n++] = 0; // Select-IR-Scan
+    }
+    tms[n] = 0, tdi[n++] = 0; // Capture
+    tms[n] = 0, tdi[n++] = 0; // Shift
+    for (int i = 0; i < bits; ++i)
+    {
+        tms[n] = (bits - 1 == i), tdi[n++] = (value >> i) & 1; // last one to Exit1
+    }
+    tms[n] = 1, tdi[n++] = 0; // Update
+    tms[n] = 0, tdi[n++] = 0; // Run-Test/Idle
+
+    size_t bytes = (n + 7) / 8;
+    p[0] = ir ? 'x' : 'X';
+    p[1] = (char)n;
+    p[2] = 0;
+    memset(&p[3], 0, 2 * bytes);
+    for (int i = 0; i < n; ++i)
+    {
+        p[3 + i / 8] |= tms[i] << (i % 8);
+        p[3 + bytes + i / 8] |= tdi[i] << (i % 8);
+    }
+    return 3 + 2 * bytes;
+}
+
+// Captured value of a DR scan sent with packed_scan(), tdo of bit 3 onwards.
+static uint64_t dr_scan(uint64_t value, int bits)
+{
+    char buf[64];
+    size_t len = packed_scan(buf, 0, value, bits);
+    send_all(buf, len);
+    size_t bytes = (bits + 5 + 7) / 8;
+    uint8_t tdo[8];
+    recv_all((char *)tdo, bytes);
+    uint64_t captured = 0;
+    for (int i = 0; i < bits; ++i)
+    {
+        captured |= (uint64_t)((tdo[(3 + i) / 8] >> ((3 + i) % 8)) & 1) << i;
+    }
+    return captured;
+}
+
+static void ir_scan(int ir)
+{
+    char buf[16];
+    send_all(buf, packed_scan(buf, 1, ir, 5));
+}
+
+static void check(int ok, const char *what, uint64_t actual, uint64_t expected)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "dmi_test: %s is 0x%llx instead of 0x%llx\n", what, (unsigned long long)actual,
+                (unsigned long long)expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// DMI scan with op on addr with data. Returns the result of the previous one,
+// which must have succeeded: OpenOCD is never to see busy (3) or failed (2).
+static uint64_t dmi_scan(int op, unsigned int addr, uint32_t data)
+{
+    uint64_t captured = dr_scan((uint64_t)addr << 34 | (uint64_t)data << 2 | op, DMI_LEN);
+    check(0 == (captured & 3), "status of DMI access", captured & 3, 0);
+    return captured;
+}
+
+static uint32_t pattern(unsigned int i)
+{
+    return 0x9e3779b9u * (i + 1);
+}
+
+static void *client(void *arg)
+{
+    (void)arg;
+    char buf[256];
+    send_all(buf, mock_reset(buf));
+
+    // IDCODE is selected after reset, scan it bit by bit as a classic host.
+    send_all(buf, mock_classic_scan(buf));
+    recv_all(buf, 32);
+    uint32_t idcode = 0;
+    for (int i = 0; i < 32; ++i)
+    {
+        idcode |= (uint32_t)('1' == buf[i]) << i;
+    }
+    check(MOCK_IDCODE == idcode, "IDCODE", idcode, MOCK_IDCODE);
+
+    // dtmcs: version 0.13, abits, no idle cycles needed and no error.
+    ir_scan(DTM_IR_DTMCS);
+    uint64_t dtmcs = dr_scan(0, 32);
+    check(1 == (dtmcs & 0xf), "dtmcs version", dtmcs & 0xf, 1);
+    check(DMI_ABITS == ((dtmcs >> 4) & 0x3f), "dtmcs abits", (dtmcs >> 4) & 0x3f, DMI_ABITS);
+    check(0 == (dtmcs >> 10 & 0x3), "dtmcs dmistat", dtmcs >> 10 & 0x3, 0);
+    check(0 == (dtmcs >> 12 & 0x7), "dtmcs idle", dtmcs >> 12 & 0x7, 0);
+
+    // Write a register and read it back, with the access of each scan still
+    // being carried out when the next scan arrives.
+    static uint32_t regs[DMI_REGS];
+    ir_scan(DTM_IR_DMI);
+    dmi_scan(DMI_OP_NOP, 0, 0);
+    for (unsigned int i = 0; i < accesses; ++i)
+    {
+        unsigned int addr = (i * 37) % DMI_REGS;
+        regs[addr] = pattern(i);
+        dmi_scan(DMI_OP_WRITE, addr, pattern(i));
+        dmi_scan(DMI_OP_READ, addr, 0);
+        uint64_t captured = dmi_scan(DMI_OP_NOP, 0, 0);
+        check(pattern(i) == (uint32_t)(captured >> 2), "read back data", (uint32_t)(captured >> 2), pattern(i));
+        check(addr == captured >> 34, "read back address", captured >> 34, addr);
+    }
+
+    // The same registers once more, this time back to back.
+    for (unsigned int i = 0; i < DMI_REGS; ++i)
+    {
+        uint64_t captured = dmi_scan(DMI_OP_READ, i, 0);
+        if (i > 0)
+        {
+            check(i - 1 == captured >> 34, "address of back to back read", captured >> 34, i - 1);
+            check(regs[i - 1] == (uint32_t)(captured >> 2), "back to back read", (uint32_t)(captured >> 2),
+                  regs[i - 1]);
+        }
+    }
+    uint64_t captured = dmi_scan(DMI_OP_NOP, 0, 0);
+    check(regs[DMI_REGS - 1] == (uint32_t)(captured >> 2), "back to back read", (uint32_t)(captured >> 2),
+          regs[DMI_REGS - 1]);
+
+    client_done = 1;
+    send_all("Q", 1);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        accesses = strtoul(argv[1], NULL, 0);
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/cosim_jtag_dmi_%d.sock", (int)getpid());
+    setenv("COSIM_JTAG_SOCKET", path, 1);
+    setenv("COSIM_JTAG_ACCEPT_INTERVAL", "0", 0);
+    char idcode[16];
+    snprintf(idcode, sizeof(idcode), "0x%08x", MOCK_IDCODE);
+    setenv("COSIM_JTAG_DMI_IDCODE", idcode, 1);
+
+    // First clk creates the socket, then OpenOCD may connect.
+    static mock_dmi_t mock;
+    mock_dmi_init(&mock);
+    mock_dmi_clk(&mock);
+    struct sockaddr_un addr = {AF_UNIX, {0}};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == connect(client_socket, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        perror("dmi_test: connect");
+        return EXIT_FAILURE;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, client, NULL);
+
+    unsigned long long clks = 0;
+    for (; !client_done; ++clks)
+    {
+        mock_dmi_clk(&mock);
+    }
+    pthread_join(thread, NULL);
+    close(client_socket);
+    unlink(path);
+
+    // Every access of OpenOCD reached the debug module exactly once, nops never.
+    unsigned long reads = accesses + DMI_REGS;
+    unsigned long writes = accesses;
+    printf("dmi_test: %lu reads and %lu writes in %llu clks\n", mock.reads, mock.writes, clks);
+    if (mock.writes != writes || mock.reads != reads)
+    {
+        fprintf(stderr, "dmi_test: failed, expected %lu reads and %lu writes\n", reads, writes);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
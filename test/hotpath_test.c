@@ -0,0 +1,332 @@
+/**
+ * @file hotpath_test.c
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief Regression test of the hot path of cosim_jtag_tick(). Replays a long
+ *        generated session of IDCODE scans (see Record and replay in README)
+ *        and fails if a single tick in steady state allocates memory, makes a
+ *        syscall or prints anything. Replies are checked by the replay itself.
+ *        The same scans are then sent over a real UNIX socket in batches,
+ *        there the simulator thread may make at most one syscall per batch.
+ * @version 0.2
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version
+ * 0.2      2026-10-14  NikLeberg  run over a UNIX socket
+ *
+ * Usage: hotpath_test [scans]
+ * Includes cosim_jtag.c itself to count the calls it makes, compile only this
+ * file: gcc -O2 -pthread -o hotpath_test hotpath_test.c
+ * All COSIM_JTAG_* settings apply, except COSIM_JTAG_REPLAY and
+ * COSIM_JTAG_SOCKET which are set by the test itself.
+ */
+
+// Everything cosim_jtag.c and cosim_jtag_shm.h include, before the macros below
+// get a chance to rename their declarations.
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/futex.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+// Count every call of cosim_jtag.c into the C library that allocates, enters
+// the kernel or prints, while counting is enabled. Only calls made by the
+// simulator thread count, not those of the I/O thread (COSIM_JTAG_THREAD).
+static __thread int counting = 0;
+static __thread unsigned long allocs = 0, syscalls = 0, prints = 0;
+
+#define COUNTED(counter, call) (counting ? (void)++(counter) : (void)0, call)
+
+#define malloc(...) COUNTED(allocs, malloc(__VA_ARGS__))
+#define calloc(...) COUNTED(allocs, calloc(__VA_ARGS__))
+#define realloc(...) COUNTED(allocs, realloc(__VA_ARGS__))
+
+#define read(...) COUNTED(syscalls, read(__VA_ARGS__))
+#define write(...) COUNTED(syscalls, write(__VA_ARGS__))
+#define send(...) COUNTED(syscalls, send(__VA_ARGS__))
+#define readv(...) COUNTED(syscalls, readv(__VA_ARGS__))
+#define sendmsg(...) COUNTED(syscalls, sendmsg(__VA_ARGS__))
+#define accept(...) COUNTED(syscalls, accept(__VA_ARGS__))
+#define poll(...) COUNTED(syscalls, poll(__VA_ARGS__))
+#define epoll_wait(...) COUNTED(syscalls, epoll_wait(__VA_ARGS__))
+#define epoll_ctl(...) COUNTED(syscalls, epoll_ctl(__VA_ARGS__))
+#define syscall(...) COUNTED(syscalls, syscall(__VA_ARGS__))
+#define fcntl(...) COUNTED(syscalls, fcntl(__VA_ARGS__))
+#define close(...) COUNTED(syscalls, close(__VA_ARGS__))
+#define open(...) COUNTED(syscalls, open(__VA_ARGS__))
+#define mmap(...) COUNTED(syscalls, mmap(__VA_ARGS__))
+#define shutdown(...) COUNTED(syscalls, shutdown(__VA_ARGS__))
+#define sched_yield(...) COUNTED(syscalls, sched_yield(__VA_ARGS__))
+#define clock_gettime(...) COUNTED(syscalls, clock_gettime(__VA_ARGS__))
+#define fwrite(...) COUNTED(syscalls, fwrite(__VA_ARGS__))
+#define fputc(...) COUNTED(syscalls, fputc(__VA_ARGS__))
+#define fflush(...) COUNTED(syscalls, fflush(__VA_ARGS__))
+
+#define fprintf(...) COUNTED(prints, fprintf(__VA_ARGS__))
+#define fputs(...) COUNTED(prints, fputs(__VA_ARGS__))
+
+#include "../cosim_jtag.c"
+
+#include "mock_tap.h"
+
+static void put_varint(FILE *f, unsigned long long value)
+{
+    do
+    {
+        fputc((value & 0x7f) | (value > 0x7f ? 0x80 : 0), f);
+        value >>= 7;
+    } while (value);
+}
+
+static void put_record(FILE *f, int type, const void *data, size_t len)
+{
+    fputc(type, f);
+    put_varint(f, 0); // all due at once, as fast as the ring takes them
+    put_varint(f, len);
+    fwrite(data, 1, len, f);
+}
+
+// Scans alternate between classic and packed ones.
+static size_t scan_commands(unsigned int i, char *p)
+{
+    return (i & 1) ? mock_packed_scan(p) : mock_classic_scan(p);
+}
+
+static size_t scan_reply(unsigned int i, char *p)
+{
+    if (i & 1)
+    {
+        for (int j = 0; j < 5; ++j)
+        {
+            p[j] = (char)(((uint64_t)MOCK_IDCODE << 3) >> (8 * j));
+        }
+        return 5;
+    }
+    for (int j = 0; j < 32; ++j)
+    {
+        p[j] = '0' + ((MOCK_IDCODE >> j) & 1);
+    }
+    return 32;
+}
+
+// Session of scans, each with the expected reply.
+static void write_session(const char *path, unsigned int scans)
+{
+    FILE *f = fopen(path, "wb");
+    if (NULL == f)
+    {
+        perror("hotpath_test: fopen");
+        exit(EXIT_FAILURE);
+    }
+    fputs("CJTR", f);
+    fputc(RECORD_VERSION, f);
+
+    char buf[256];
+    put_record(f, RECORD_RX, buf, mock_reset(buf));
+    for (unsigned int i = 0; i < scans; ++i)
+    {
+        put_record(f, RECORD_RX, buf, scan_commands(i, buf));
+        put_record(f, RECORD_TX, buf, scan_reply(i, buf));
+    }
+    put_record(f, RECORD_RX, "Q", 1);
+    fclose(f);
+}
+
+// Scans per batch of the socket run, commands and replies fit into a ring.
+#define BATCH_SCANS 16
+
+// Socket run, OpenOCD's side. Sends the scans in batches and waits for all
+// replies of a batch before sending the next, as OpenOCD does whenever it
+// flushes its queue. The reset goes along with the first batch.
+static void run_remote(const char *path, unsigned int batches, pid_t simulation)
+{
+    struct sockaddr_un addr = {AF_UNIX, {0}};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    while (-1 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        if (0 != waitpid(simulation, NULL, WNOHANG))
+        {
+            fprintf(stderr, "hotpath_test: simulation exited before listening on %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        usleep(1000);
+    }
+
+    char commands[RING_SIZE], expected[RING_SIZE], replies[RING_SIZE];
+    for (unsigned int b = 0; b < batches; ++b)
+    {
+        size_t len = (0 == b) ? mock_reset(commands) : 0;
+        size_t reply_len = 0;
+        for (unsigned int i = 0; i < BATCH_SCANS; ++i)
+        {
+            len += scan_commands(i, &commands[len]);
+            reply_len += scan_reply(i, &expected[reply_len]);
+        }
+        if (len != (size_t)send(fd, commands, len, 0))
+        {
+            perror("hotpath_test: send");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t done = 0; done < reply_len;)
+        {
+            ssize_t ret = recv(fd, &replies[done], reply_len - done, 0);
+            if (ret <= 0)
+            {
+                perror("hotpath_test: recv");
+                exit(EXIT_FAILURE);
+            }
+            done += ret;
+        }
+        if (0 != memcmp(replies, expected, reply_len))
+        {
+            fprintf(stderr, "hotpath_test: batch %u over the socket got wrong replies\n", b);
+            exit(EXIT_FAILURE);
+        }
+    }
+    send(fd, "Q", 1, 0);
+    close(fd);
+}
+
+// Socket run, the simulation. Counts from the tick that accepted the remote
+// until the replies of all but the last batch are gone. In that window the
+// remote sends (all) commands of each batch and the simulation replies to all
+// but the last, each a batch of bytes crossing the socket. A blocking read or
+// a wait for the I/O thread is fine, one per batch, but nothing more. Without
+// blocking and without the I/O thread, the simulation polls the socket while
+// the remote is busy, as often as COSIM_JTAG_IDLE_POLL says. Those syscalls
+// are on purpose and not bounded.
+static int run_simulation(const char *path, unsigned int batches)
+{
+    setenv("COSIM_JTAG_SOCKET", path, 1);
+    setenv("COSIM_JTAG_ACCEPT_INTERVAL", "0", 0); // connect right away
+    mock_t mock;
+    mock_init(&mock);
+    while (NULL == instances[0] || !(config.thread ? instances[0]->linked : -1 != instances[0]->data_socket))
+    {
+        mock_clk(&mock);
+    }
+    instance_t *inst = instances[0];
+
+    char buf[64];
+    unsigned int reply_bytes = 0;
+    for (unsigned int i = 0; i < BATCH_SCANS; ++i)
+    {
+        reply_bytes += scan_reply(i, buf);
+    }
+    unsigned int until = reply_bytes * (batches - 1);
+    unsigned long long first = mock.ticks;
+    counting = 1;
+    while (__atomic_load_n(&inst->tx_ring.tail, __ATOMIC_ACQUIRE) != until)
+    {
+        mock_clk(&mock);
+    }
+    counting = 0;
+    while (config.thread ? inst->linked : -1 != inst->data_socket)
+    {
+        mock_clk(&mock); // serve the last batch until the remote quits
+    }
+
+    unsigned long crossed = 2 * batches - 1;
+    int polling = config.nonblock && !config.thread;
+    printf("hotpath_test: %u scans over a socket, %llu ticks: %lu allocations, %lu syscalls for %lu "
+           "batches%s, %lu prints\n",
+           batches * BATCH_SCANS, mock.ticks - first, allocs, syscalls, crossed,
+           polling ? " (polling, not bounded)" : "", prints);
+    if (allocs || (!polling && syscalls > crossed) || prints)
+    {
+        fprintf(stderr, "hotpath_test: failed, over a socket the hot path must neither allocate nor "
+                        "print and make at most one syscall per batch\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int scans = 20000;
+    if (argc > 1)
+    {
+        scans = strtoul(argv[1], NULL, 0);
+    }
+    char path[64];
+
+    // Socket run first, in a process of its own. This one then plays OpenOCD.
+    unsigned int batches = (scans + BATCH_SCANS - 1) / BATCH_SCANS;
+    snprintf(path, sizeof(path), "/tmp/cosim_jtag_hotpath_%d.sock", (int)getpid());
+    fflush(stdout);
+    pid_t simulation = fork();
+    if (0 == simulation)
+    {
+        exit(run_simulation(path, batches));
+    }
+    run_remote(path, batches, simulation);
+    int status;
+    waitpid(simulation, &status, 0);
+    unlink(path);
+    if (!WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status))
+    {
+        return EXIT_FAILURE;
+    }
+
+    snprintf(path, sizeof(path), "/tmp/cosim_jtag_hotpath_%d.cjtr", (int)getpid());
+    write_session(path, scans);
+    setenv("COSIM_JTAG_REPLAY", path, 1);
+
+    // The first ticks set up the instance and announce it, that may allocate
+    // and print. Everything after is steady state.
+    mock_t mock;
+    mock_init(&mock);
+    while (NULL == instances[0] || instances[0]->tick < 2)
+    {
+        mock_clk(&mock);
+    }
+    instance_t *inst = instances[0];
+    unsigned long long first = mock.ticks;
+    counting = 1;
+    while (!inst->replay->eof || ring_count(&inst->rx_ring))
+    {
+        mock_clk(&mock);
+    }
+    counting = 0;
+    unlink(path); // stays mapped until the end
+
+    printf("hotpath_test: %u scans, %llu ticks: %lu allocations, %lu syscalls, %lu prints\n", scans,
+           mock.ticks - first, allocs, syscalls, prints);
+    if (allocs || syscalls || prints)
+    {
+        fprintf(stderr, "hotpath_test: failed, the hot path must neither allocate, enter the kernel nor print\n");
+        return EXIT_FAILURE;
+    }
+    // The replay ends the process once it checked the last reply.
+    for (;;)
+    {
+        mock_clk(&mock);
+    }
+}
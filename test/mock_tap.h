@@ -0,0 +1,236 @@
+/**
+ * @file mock_tap.h
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief The VHDL entity cosim_jtag together with a mock TAP, for tests and
+ *        benchmarks that call cosim_jtag_tick() without any simulator. The TAP
+ *        has irlen 5, IDCODE (instruction 1, also after reset) and BYPASS.
+ *        Also the commands OpenOCD would send to scan its IDCODE.
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version, split from tick_bench.c
+ *
+ */
+
+#ifndef MOCK_TAP_H
+#define MOCK_TAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MOCK_0 2 // STD_ULOGIC '0'
+#define MOCK_1 3 // STD_ULOGIC '1'
+#define MOCK_IDCODE 0x12345679
+#define MOCK_SCAN_BITS 256 // must match VSCAN_BITS of cosim_jtag.c
+
+void cosim_jtag_tick(int id, char tdo, char *tck, char *tms, char *tdi, char *trst, char *srst,
+                     char *tck2, char *tms2, char *tdi2, int *edges, int *skip, int *changed,
+                     int *repeat, const char *scan_tdo, int *scan_len, char *scan_tms, char *scan_tdi);
+
+enum
+{
+    MOCK_RESET, MOCK_IDLE, MOCK_DRSELECT, MOCK_DRCAPTURE, MOCK_DRSHIFT, MOCK_DREXIT1, MOCK_DRPAUSE,
+    MOCK_DREXIT2, MOCK_DRUPDATE, MOCK_IRSELECT, MOCK_IRCAPTURE, MOCK_IRSHIFT, MOCK_IREXIT1,
+    MOCK_IRPAUSE, MOCK_IREXIT2, MOCK_IRUPDATE
+};
+static const int mock_next[16][2] = {
+    {MOCK_IDLE, MOCK_RESET}, {MOCK_IDLE, MOCK_DRSELECT}, {MOCK_DRCAPTURE, MOCK_IRSELECT},
+    {MOCK_DRSHIFT, MOCK_DREXIT1}, {MOCK_DRSHIFT, MOCK_DREXIT1}, {MOCK_DRPAUSE, MOCK_DRUPDATE},
+    {MOCK_DRPAUSE, MOCK_DREXIT2}, {MOCK_DRSHIFT, MOCK_DRUPDATE}, {MOCK_IDLE, MOCK_DRSELECT},
+    {MOCK_IRCAPTURE, MOCK_RESET}, {MOCK_IRSHIFT, MOCK_IREXIT1}, {MOCK_IRSHIFT, MOCK_IREXIT1},
+    {MOCK_IRPAUSE, MOCK_IRUPDATE}, {MOCK_IRPAUSE, MOCK_IREXIT2}, {MOCK_IRSHIFT, MOCK_IRUPDATE},
+    {MOCK_IDLE, MOCK_DRSELECT}};
+
+typedef struct
+{
+    // TAP
+    int state;
+    unsigned int ir, ir_shift;
+    uint32_t dr_shift;
+    char tdo, last_tck;
+    // Entity, see cosim_jtag.vhd.
+    char tck, tms, tdi, trst, srst;
+    char tck2, tms2, tdi2;
+    int edges, skip, changed, repeat, scan_len;
+    unsigned int scan_pos, scan_rise, second;
+    char scan_tms[MOCK_SCAN_BITS], scan_tdi[MOCK_SCAN_BITS], scan_tdo[MOCK_SCAN_BITS];
+    unsigned long long ticks; // calls into C
+} mock_t;
+
+static void mock_init(mock_t *m)
+{
+    *m = (mock_t){.state = MOCK_RESET, .ir = 1, .tdo = MOCK_0, .last_tck = MOCK_0, .tck = MOCK_0,
+                  .tms = MOCK_0, .tdi = MOCK_0, .trst = MOCK_0, .srst = MOCK_0, .edges = 1};
+}
+
+static void mock_tap_update(mock_t *m)
+{
+    if (MOCK_1 == m->tck && MOCK_1 != m->last_tck)
+    {
+        switch (m->state)
+        {
+        case MOCK_DRCAPTURE:
+            m->dr_shift = (1 == m->ir) ? MOCK_IDCODE : 0;
+            break;
+        case MOCK_DRSHIFT:
+            m->dr_shift = m->dr_shift >> 1 | (uint32_t)(MOCK_1 == m->tdi) << ((1 == m->ir) ? 31 : 0);
+            break;
+        case MOCK_IRCAPTURE:
+            m->ir_shift = 1;
+            break;
+        case MOCK_IRSHIFT:
+            m->ir_shift = m->ir_shift >> 1 | (MOCK_1 == m->tdi) << 4;
+            break;
+        case MOCK_IRUPDATE:
+            m->ir = m->ir_shift;
+            break;
+        }
+        m->state = mock_next[m->state][MOCK_1 == m->tms];
+        if (MOCK_RESET == m->state)
+        {
+            m->ir = 1;
+        }
+    }
+    else if (MOCK_0 == m->tck && MOCK_0 != m->last_tck)
+    {
+        unsigned int out = 0;
+        if (MOCK_DRSHIFT == m->state)
+        {
+            out = m->dr_shift & 1;
+        }
+        else if (MOCK_IRSHIFT == m->state)
+        {
+            out = m->ir_shift & 1;
+        }
+        m->tdo = out ? MOCK_1 : MOCK_0;
+    }
+    m->last_tck = m->tck;
+}
+
+// Calls into C without driving anything, as the entity does on its first clk.
+static void mock_tick(mock_t *m)
+{
+    char v_tck, v_tms, v_tdi, v_trst, v_srst;
+    cosim_jtag_tick(0, m->tdo, &v_tck, &v_tms, &v_tdi, &v_trst, &v_srst, &m->tck2, &m->tms2, &m->tdi2,
+                    &m->edges, &m->skip, &m->changed, &m->repeat, m->scan_tdo, &m->scan_len,
+                    m->scan_tms, m->scan_tdi);
+    m->ticks++;
+    if (m->scan_len > 0)
+    {
+        m->tck = MOCK_0;
+        m->tms = m->scan_tms[0];
+        m->tdi = m->scan_tdi[0];
+        m->scan_pos = 0;
+        m->scan_rise = 1;
+    }
+    m->tck = (m->changed & 0x01) ? v_tck : m->tck;
+    m->tms = (m->changed & 0x02) ? v_tms : m->tms;
+    m->tdi = (m->changed & 0x04) ? v_tdi : m->tdi;
+    m->trst = (m->changed & 0x08) ? v_trst : m->trst;
+    m->srst = (m->changed & 0x10) ? v_srst : m->srst;
+    m->second = (2 == m->edges);
+}
+
+// One rising edge of clk with DELAY 0, the entity followed by the TAP.
+static void mock_clk(mock_t *m)
+{
+    if (m->skip > 0)
+    {
+        m->skip--;
+        return;
+    }
+    if (m->second)
+    {
+        m->tck = (m->changed & 0x20) ? m->tck2 : m->tck;
+        m->tms = (m->changed & 0x40) ? m->tms2 : m->tms;
+        m->tdi = (m->changed & 0x80) ? m->tdi2 : m->tdi;
+        m->second = 0;
+    }
+    else if (m->repeat > 0)
+    {
+        m->tck = (MOCK_1 == m->tck) ? MOCK_0 : MOCK_1;
+        m->repeat--;
+    }
+    else if (m->scan_pos < (unsigned int)m->scan_len)
+    {
+        if (m->scan_rise)
+        {
+            m->scan_tdo[m->scan_pos++] = m->tdo;
+            m->tck = MOCK_1;
+            m->scan_rise = 0;
+        }
+        else
+        {
+            m->tck = MOCK_0;
+            m->tms = m->scan_tms[m->scan_pos];
+            m->tdi = m->scan_tdi[m->scan_pos];
+            m->scan_rise = 1;
+        }
+    }
+    else
+    {
+        mock_tick(m);
+    }
+    mock_tap_update(m);
+}
+
+// OpenOCD side: One clock with the given tms and tdi.
+static char *mock_write_clock(char *p, int tms, int tdi)
+{
+    *p++ = '0' + (tms << 1 | tdi);
+    *p++ = '4' + (tms << 1 | tdi);
+    return p;
+}
+
+// Reset and then through Test-Logic-Reset to Run-Test/Idle.
+static size_t mock_reset(char *p)
+{
+    char *start = p;
+    *p++ = 'r';
+    for (int i = 0; i < 5; ++i)
+    {
+        p = mock_write_clock(p, 1, 0); // Test-Logic-Reset
+    }
+    p = mock_write_clock(p, 0, 0); // Run-Test/Idle
+    return p - start;
+}
+
+// From Run-Test/Idle through IDCODE and back, 32 bits with a read each. The
+// replies are one '0' or '1' per bit of the IDCODE, LSB first.
+static size_t mock_classic_scan(char *p)
+{
+    char *start = p;
+    p = mock_write_clock(p, 1, 0); // Select-DR-Scan
+    p = mock_write_clock(p, 0, 0); // Capture-DR
+    p = mock_write_clock(p, 0, 0); // Shift-DR
+    for (int i = 0; i < 32; ++i)
+    {
+        int tms = (31 == i);
+        *p++ = '0' + (tms << 1);
+        *p++ = 'R';
+        *p++ = '4' + (tms << 1);
+    }
+    p = mock_write_clock(p, 1, 0); // Update-DR
+    p = mock_write_clock(p, 0, 0); // Run-Test/Idle
+    return p - start;
+}
+
+// Same as a packed scan of 37 bits, tdo of bit 3 to 34 is the IDCODE. The reply
+// is 5 bytes of the IDCODE shifted left by 3, little endian.
+static size_t mock_packed_scan(char *p)
+{
+    static const uint8_t tms[5] = {0x01, 0x00, 0x00, 0x00, 0x0c};
+    p[0] = 'X';
+    p[1] = 37;
+    p[2] = 0;
+    memcpy(&p[3], tms, 5);
+    memset(&p[8], 0, 5);
+    return 13;
+}
+
+#endif // MOCK_TAP_H
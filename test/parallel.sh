@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+
+# This script runs the debug regression of the test_<simulator>.sh scripts many
+# times in parallel, each simulation with its own OpenOCD and GDB. Every
+# simulation listens on a socket named after its process id and announces it
+# in its own ready file, written as Tcl for OpenOCD (see COSIM_JTAG_READY in
+# README). OpenOCD is not started as a server but by GDB through a pipe, so
+# neither needs a port and nothing is shared between the jobs.
+#
+# Usage: ./parallel.sh <count> <simulation command>...
+# e.g.   ./parallel.sh 32 nvc -L. -r --load ./cosim_jtag.so --ieee-warnings=off tb
+#
+# At most JOBS (default: number of cores) run at the same time. Logs of job N
+# are kept in parallel/N. Exits with failure if any of the jobs failed.
+#
+# Note: Like bench.sh, this neither sets up a container nor builds anything. Run
+# it where the respective test script ran, after it built the testbench.
+
+set -e
+
+COUNT=$1
+shift
+if [ -z "$COUNT" ] || [ $# -eq 0 ]; then
+    echo "usage: $0 <count> <simulation command>..." >&2
+    exit 1
+fi
+JOBS=${JOBS:-$(nproc)}
+
+# Run the simulation given as arguments, wait until it listens and debug it.
+run_job() {
+    local DIR=parallel/$1
+    shift
+    rm -rf $DIR
+    mkdir -p $DIR
+    COSIM_JTAG_SOCKET=/tmp/cosim_jtag_%p.sock COSIM_JTAG_WAIT=1 \
+        COSIM_JTAG_READY=$DIR/cosim_jtag.ready.tcl "$@" >$DIR/sim.log 2>&1 &
+    local SIM=$!
+    while [ ! -e $DIR/cosim_jtag.ready.tcl ]; do
+        if ! kill -0 $SIM 2>/dev/null; then
+            echo "parallel: $DIR simulation exited early" >&2
+            echo 1 >$DIR/result
+            return
+        fi
+        sleep 0.1
+    done
+
+    # Same debugging as gdb.cfg, but with a private OpenOCD on a pipe. It has
+    # to be configured before openocd.cfg runs init.
+    local OPENOCD="openocd -f $DIR/cosim_jtag.ready.tcl"
+    OPENOCD+=" -c 'gdb_port pipe; telnet_port disabled; tcl_port disabled; log_output $DIR/openocd.log'"
+    OPENOCD+=" -f openocd.cfg"
+    sed "s#^target extended-remote .*#target extended-remote | $OPENOCD#" gdb.cfg >$DIR/gdb.cfg
+    local RESULT=0
+    gdb-multiarch --batch -x $DIR/gdb.cfg >$DIR/gdb.log 2>&1 || RESULT=1
+    grep -qs "Breakpoint 1, " $DIR/gdb.log || RESULT=1
+
+    kill $SIM 2>/dev/null || true
+    wait $SIM 2>/dev/null || true
+    # Unlike with a fixed path, the next run would not replace the socket.
+    rm -f "$(sed -n 's/^set cosim_jtag_host(0) {\(.*\)}$/\1/p' $DIR/cosim_jtag.ready.tcl)"
+    if [ $RESULT -ne 0 ]; then
+        echo "parallel: $DIR failed, see its logs" >&2
+    fi
+    echo $RESULT >$DIR/result
+}
+
+cd "$(dirname "$0")"
+START=$(date +%s)
+for ((i = 0; i < COUNT; i++)); do
+    while [ $(jobs -rp | wc -l) -ge $JOBS ]; do
+        wait -n || true
+    done
+    run_job $i "$@" &
+done
+wait
+FAILED=0
+for ((i = 0; i < COUNT; i++)); do
+    if [ "$(cat parallel/$i/result 2>/dev/null)" != "0" ]; then
+        FAILED=$((FAILED + 1))
+    fi
+done
+echo "parallel: $((COUNT - FAILED)) of $COUNT passed in $(($(date +%s) - START)) s"
+[ $FAILED -eq 0 ]
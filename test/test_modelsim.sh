@@ -61,28 +61,49 @@ vcom -work cosim ../cosim_jtag_fli.vhd ../cosim_jtag.vhd
 vcom tb.vhd
 
 # Compile our C file into a shared library.
-gcc -shared -fPIC -m32 -Bsymbolic -o cosim_jtag.so ../cosim_jtag.c
+# -> With FLI for checkpoint and restore, the simulator provides mti.h.
+gcc -shared -fPIC -m32 -Bsymbolic -DUSE_FLI -I$(dirname $(which vsim))/../include -o cosim_jtag.so ../cosim_jtag.c
 # libc6-i386
 
 # Run the simulation in the background.
-# -> Shared library "cosim_jtag.so" is automatically loaded.
-vsim -c tb -foreign "cosim_jtag_dummy ./cosim_jtag.so" -do "run -all" &
+# -> Shared library "cosim_jtag.so" is automatically loaded. Loading it as
+#    foreign module too registers its checkpoint callbacks.
+# -> Block the simulation until OpenOCD connects and announce the socket in
+#    file cosim_jtag.ready.
+rm -f cosim_jtag.ready openocd.log
+COSIM_JTAG_WAIT=1 COSIM_JTAG_READY=cosim_jtag.ready vsim -c tb -foreign "cosim_jtag_fli_init ./cosim_jtag.so" -do "run -all" &
 
-# Wait a bit to ensure simulation could boot and UNIX socket could be created.
-sleep 5
+# Wait until the simulation booted and the UNIX socket was created.
+while [ ! -e cosim_jtag.ready ]; do kill -0 %1; sleep 0.1; done
 
 # Run openocd in the background.
 # -> If this errors out, see whats going wrong by adding debugging flag -d.
 # -> If an invalid tap/device id is read: Try to increase DELAY generic in VHDL.
-openocd -f openocd.cfg &
+openocd -f openocd.cfg 2>&1 | tee openocd.log &
 
-# Wait a bit longer to ensure openocd could examine hart and start gdb server.
-sleep 10
+# Wait until openocd examined the hart and started its gdb server.
+until grep -qs "Listening on port 3333" openocd.log; do kill -0 %2; sleep 0.1; done
 
 # Run some debugging.
 gdb-multiarch --batch -x gdb.cfg
 
-# Stop background openocd and GHDL simulation.
+# Stop background openocd and the simulation.
+kill %2
+sleep 1
+kill %1
+wait || true
+
+# Debug again, this time starting from a checkpoint taken after the boot
+# instead of simulating it again.
+# -> restore.log has to show that the C side restored its state.
+rm -f boot.cpt cosim_jtag.ready openocd.log restore.log
+vsim -c tb -foreign "cosim_jtag_fli_init ./cosim_jtag.so" -do "run 1 ms; checkpoint boot.cpt; quit -f"
+COSIM_JTAG_WAIT=1 COSIM_JTAG_READY=cosim_jtag.ready vsim -c -restore boot.cpt -do "run -all" >restore.log 2>&1 &
+while [ ! -e cosim_jtag.ready ]; do kill -0 %1; sleep 0.1; done
+grep "cosim_jtag: restored 1 instance(s) from checkpoint" restore.log
+openocd -f openocd.cfg 2>&1 | tee openocd.log &
+until grep -qs "Listening on port 3333" openocd.log; do kill -0 %2; sleep 0.1; done
+gdb-multiarch --batch -x gdb.cfg
 kill %2
 sleep 1
 kill %1
@@ -68,18 +68,21 @@ nvc -L. -e tb
 # Run the simulation in the background.
 # -> Shared library "cosim_jtag.so" must be manually loaded.
 # -> Flag "ieee-warnings" is NEORV32 specific.
-nvc -L. -r --load ./cosim_jtag.so --ieee-warnings=off tb &
+# -> Block the simulation until OpenOCD connects and announce the socket in
+#    file cosim_jtag.ready.
+rm -f cosim_jtag.ready openocd.log
+COSIM_JTAG_WAIT=1 COSIM_JTAG_READY=cosim_jtag.ready nvc -L. -r --load ./cosim_jtag.so --ieee-warnings=off tb &
 
-# Wait a bit to ensure simulation could boot and UNIX socket could be created.
-sleep 2
+# Wait until the simulation booted and the UNIX socket was created.
+while [ ! -e cosim_jtag.ready ]; do kill -0 %1; sleep 0.1; done
 
 # Run openocd in the background.
 # -> If this errors out, see whats going wrong by adding debugging flag -d.
 # -> If an invalid tap/device id is read: Try to increase DELAY generic in VHDL.
-openocd -f openocd.cfg &
+openocd -f openocd.cfg 2>&1 | tee openocd.log &
 
-# Wait a bit longer to ensure openocd could examine hart and start gdb server.
-sleep 10
+# Wait until openocd examined the hart and started its gdb server.
+until grep -qs "Listening on port 3333" openocd.log; do kill -0 %2; sleep 0.1; done
 
 # Run some debugging.
 gdb-multiarch --batch -x gdb.cfg
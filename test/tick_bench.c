@@ -0,0 +1,172 @@
+/**
+ * @file tick_bench.c
+ * @author Niklaus Leuenberger <@NikLeberg>
+ * @brief Microbenchmark of cosim_jtag_tick() without any simulator. The main
+ *        thread plays the VHDL entity cosim_jtag together with a mock TAP, a
+ *        second thread plays OpenOCD and scans IDCODE over and over. Reports
+ *        time per tick and shifted bits per second. See bench.sh.
+ * @version 0.2
+ * @date 2026-10-14
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Changes:
+ * Version  Date        Author     Detail
+ * 0.1      2026-10-14  NikLeberg  initial version
+ * 0.2      2026-10-14  NikLeberg  entity and TAP moved to mock_tap.h
+ *
+ * Usage: tick_bench [scans]
+ * Compile together with cosim_jtag.c, see bench.sh. All COSIM_JTAG_* settings
+ * apply, except COSIM_JTAG_SOCKET which is set by the benchmark itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mock_tap.h"
+
+// OpenOCD side, half of the scans bit by bit and half of them packed.
+static int client_socket = -1;
+static unsigned int scans = 20000;
+static volatile int client_done = 0;
+
+static void send_all(const char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = send(client_socket, buf, len, 0);
+        if (ret <= 0)
+        {
+            perror("tick_bench: send");
+            exit(EXIT_FAILURE);
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+static void recv_all(char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = recv(client_socket, buf, len, 0);
+        if (ret <= 0)
+        {
+            perror("tick_bench: recv");
+            exit(EXIT_FAILURE);
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+static void *client_writer(void *arg)
+{
+    (void)arg;
+    char buf[256];
+    size_t len = mock_reset(buf);
+    send_all(buf, len);
+
+    for (unsigned int i = 0; i < scans; ++i)
+    {
+        len = (i & 1) ? mock_packed_scan(buf) : mock_classic_scan(buf);
+        send_all(buf, len);
+    }
+    send_all("Q", 1);
+    return NULL;
+}
+
+static void *client_reader(void *arg)
+{
+    (void)arg;
+    for (unsigned int i = 0; i < scans; ++i)
+    {
+        uint32_t value = 0;
+        if (i & 1)
+        {
+            uint8_t tdo[5];
+            recv_all((char *)tdo, sizeof(tdo));
+            uint64_t bits = 0;
+            for (int j = 0; j < 5; ++j)
+            {
+                bits |= (uint64_t)tdo[j] << (8 * j);
+            }
+            value = (uint32_t)(bits >> 3);
+        }
+        else
+        {
+            char tdo[32];
+            recv_all(tdo, sizeof(tdo));
+            for (int j = 0; j < 32; ++j)
+            {
+                value |= (uint32_t)('1' == tdo[j]) << j;
+            }
+        }
+        if (MOCK_IDCODE != value)
+        {
+            fprintf(stderr, "tick_bench: scan %u read 0x%08x instead of 0x%08x\n", i, value, MOCK_IDCODE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    client_done = 1;
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        scans = strtoul(argv[1], NULL, 0) & ~1u;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/cosim_jtag_bench_%d.sock", (int)getpid());
+    setenv("COSIM_JTAG_SOCKET", path, 1);
+    setenv("COSIM_JTAG_ACCEPT_INTERVAL", "0", 0); // don't measure the wait for accept
+
+    // First tick creates the socket, then OpenOCD may connect.
+    mock_t mock;
+    mock_init(&mock);
+    mock_tick(&mock);
+    struct sockaddr_un addr = {AF_UNIX, {0}};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == connect(client_socket, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        perror("tick_bench: connect");
+        return EXIT_FAILURE;
+    }
+    pthread_t writer, reader;
+    pthread_create(&writer, NULL, client_writer, NULL);
+    pthread_create(&reader, NULL, client_reader, NULL);
+
+    unsigned long long clks = 0;
+    double start = now();
+    for (; !client_done; ++clks)
+    {
+        mock_clk(&mock);
+    }
+    double elapsed = now() - start;
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    close(client_socket);
+    unlink(path);
+
+    unsigned long long bits = (unsigned long long)scans * 32;
+    printf("tick_bench: %u scans, %llu ticks, %llu clks in %.3f s: %.1f ns/tick, %.0f bits/s\n", scans,
+           mock.ticks, clks, elapsed, elapsed * 1e9 / mock.ticks, bits / elapsed);
+    return EXIT_SUCCESS;
+}